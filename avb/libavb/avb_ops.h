@@ -308,6 +308,25 @@ struct AvbOps {
                                         const char* name,
                                         size_t value_size,
                                         const uint8_t* value);
+
+  /* Reads the first |num_bytes| of partition |partition| into |buffer|
+   * like |read_from_partition| does, but calls |chunk_done| with
+   * |user| on each consecutive piece of |buffer| as soon as it has been
+   * read, while the following pieces are still being transferred. The
+   * pieces cover the |out_num_read| bytes read, in order.
+   *
+   * This lets the caller hash a partition while it is being loaded
+   * instead of once it is fully in memory. This function pointer can
+   * be set to NULL, in which case |read_from_partition| is used.
+   */
+  AvbIOResult (*read_from_partition_streamed)(
+      AvbOps* ops,
+      const char* partition,
+      size_t num_bytes,
+      void* buffer,
+      size_t* out_num_read,
+      void (*chunk_done)(void* user, const uint8_t* data, size_t len),
+      void* user);
 };
 
 #ifdef __cplusplus
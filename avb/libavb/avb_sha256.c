@@ -36,6 +36,14 @@
  */
 
 #include "avb_sha.h"
+#include "avb_util.h"
+
+/* On x86, blocks are processed with the SHA extensions (SHA-NI) when
+ * the CPU supports them. */
+#if defined(__x86_64__) || defined(__i386__)
+#define AVB_SHA256_SHA_NI
+#include <immintrin.h>
+#endif
 
 #define SHFR(x, n) (x >> n)
 #define ROTR(x, n) ((x >> n) | (x << ((sizeof(x) << 3) - n)))
@@ -133,9 +141,9 @@ void avb_sha256_init(AvbSHA256Ctx* ctx) {
   ctx->tot_len = 0;
 }
 
-static void SHA256_transform(AvbSHA256Ctx* ctx,
-                             const uint8_t* message,
-                             size_t block_nb) {
+static void SHA256_transform_c(AvbSHA256Ctx* ctx,
+                               const uint8_t* message,
+                               size_t block_nb) {
   uint32_t w[64];
   uint32_t wv[8];
   uint32_t t1, t2;
@@ -332,6 +340,189 @@ static void SHA256_transform(AvbSHA256Ctx* ctx,
   }
 }
 
+#ifdef AVB_SHA256_SHA_NI
+/* Four rounds with SHA-NI. |w0| holds the message words of these
+ * rounds. For rounds 16 to 63, they are first computed from the
+ * previous ones, |w0| holding words i - 16 to i - 13, |w1| i - 12 to
+ * i - 9, |w2| i - 8 to i - 5 and |w3| i - 4 to i - 1.
+ */
+#define SHA256_NI_ROUNDS(i, w0)                                       \
+  {                                                                   \
+    msg = _mm_add_epi32(w0, _mm_loadu_si128((const __m128i*)&sha256_k[i])); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);              \
+    msg = _mm_shuffle_epi32(msg, 0x0E);                               \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);              \
+  }
+
+#define SHA256_NI_SCHED(w0, w1, w2, w3)                        \
+  {                                                            \
+    w0 = _mm_sha256msg1_epu32(w0, w1);                         \
+    w0 = _mm_add_epi32(w0, _mm_alignr_epi8(w3, w2, 4));        \
+    w0 = _mm_sha256msg2_epu32(w0, w3);                         \
+  }
+
+__attribute__((target("sha,sse4.1"))) static void SHA256_transform_ni(
+    uint32_t h[8], const uint8_t* message, size_t block_nb) {
+  const __m128i bswap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, abef, cdgh, msg, tmp;
+  __m128i w0, w1, w2, w3;
+  size_t i;
+
+  /* The SHA-NI instructions work on the ABEF/CDGH state layout. */
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[0]), 0xB1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[4]), 0x1B);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for (i = 0; i < block_nb; i++, message += AVB_SHA256_BLOCK_SIZE) {
+    abef = state0;
+    cdgh = state1;
+
+    w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)message), bswap);
+    w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(message + 16)),
+                          bswap);
+    w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(message + 32)),
+                          bswap);
+    w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(message + 48)),
+                          bswap);
+
+    SHA256_NI_ROUNDS(0, w0);
+    SHA256_NI_ROUNDS(4, w1);
+    SHA256_NI_ROUNDS(8, w2);
+    SHA256_NI_ROUNDS(12, w3);
+    SHA256_NI_SCHED(w0, w1, w2, w3);
+    SHA256_NI_ROUNDS(16, w0);
+    SHA256_NI_SCHED(w1, w2, w3, w0);
+    SHA256_NI_ROUNDS(20, w1);
+    SHA256_NI_SCHED(w2, w3, w0, w1);
+    SHA256_NI_ROUNDS(24, w2);
+    SHA256_NI_SCHED(w3, w0, w1, w2);
+    SHA256_NI_ROUNDS(28, w3);
+    SHA256_NI_SCHED(w0, w1, w2, w3);
+    SHA256_NI_ROUNDS(32, w0);
+    SHA256_NI_SCHED(w1, w2, w3, w0);
+    SHA256_NI_ROUNDS(36, w1);
+    SHA256_NI_SCHED(w2, w3, w0, w1);
+    SHA256_NI_ROUNDS(40, w2);
+    SHA256_NI_SCHED(w3, w0, w1, w2);
+    SHA256_NI_ROUNDS(44, w3);
+    SHA256_NI_SCHED(w0, w1, w2, w3);
+    SHA256_NI_ROUNDS(48, w0);
+    SHA256_NI_SCHED(w1, w2, w3, w0);
+    SHA256_NI_ROUNDS(52, w1);
+    SHA256_NI_SCHED(w2, w3, w0, w1);
+    SHA256_NI_ROUNDS(56, w2);
+    SHA256_NI_SCHED(w3, w0, w1, w2);
+    SHA256_NI_ROUNDS(60, w3);
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128((__m128i*)&h[0], state0);
+  _mm_storeu_si128((__m128i*)&h[4], state1);
+}
+
+static bool sha256_cpu_has_sha_ni(void) {
+  uint32_t reg[4];
+
+  avb_cpuid(0, reg);
+  if (reg[0] < 7) {
+    return false;
+  }
+
+  /* SSSE3 and SSE4.1 are needed for the state and message shuffles. */
+  avb_cpuid(1, reg);
+  if (!(reg[2] & (1 << 9)) || !(reg[2] & (1 << 19))) {
+    return false;
+  }
+
+  avb_cpuid(7, reg);
+  return (reg[1] & (1 << 29)) != 0;
+}
+
+/* Known-answer test of the SHA-NI code with the one and two block
+ * messages from FIPS 180-2, "abc" and
+ * "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq".
+ */
+static bool SHA256_transform_ni_self_test(void) {
+  static const char msg2[] =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  static const uint32_t expected1[8] = {0xba7816bf,
+                                        0x8f01cfea,
+                                        0x414140de,
+                                        0x5dae2223,
+                                        0xb00361a3,
+                                        0x96177a9c,
+                                        0xb410ff61,
+                                        0xf20015ad};
+  static const uint32_t expected2[8] = {0x248d6a61,
+                                        0xd20638b8,
+                                        0xe5c02693,
+                                        0x0c3e6039,
+                                        0xa33ce459,
+                                        0x64ff2167,
+                                        0xf6ecedd4,
+                                        0x19db06c1};
+  uint8_t blocks[2 * AVB_SHA256_BLOCK_SIZE];
+  uint32_t h[8];
+
+  avb_memset(blocks, 0, sizeof(blocks));
+  avb_memcpy(blocks, "abc", 3);
+  blocks[3] = 0x80;
+  blocks[AVB_SHA256_BLOCK_SIZE - 1] = 3 * 8;
+  avb_memcpy(h, sha256_h0, sizeof(h));
+  SHA256_transform_ni(h, blocks, 1);
+  if (avb_safe_memcmp(h, expected1, sizeof(h)) != 0) {
+    return false;
+  }
+
+  avb_memset(blocks, 0, sizeof(blocks));
+  avb_memcpy(blocks, msg2, sizeof(msg2) - 1);
+  blocks[sizeof(msg2) - 1] = 0x80;
+  blocks[sizeof(blocks) - 2] = ((sizeof(msg2) - 1) * 8) >> 8;
+  blocks[sizeof(blocks) - 1] = ((sizeof(msg2) - 1) * 8) & 0xff;
+  avb_memcpy(h, sha256_h0, sizeof(h));
+  SHA256_transform_ni(h, blocks, 2);
+  return avb_safe_memcmp(h, expected2, sizeof(h)) == 0;
+}
+
+static bool sha256_use_sha_ni(void) {
+  /* -1: not probed yet, 0: portable code, 1: SHA-NI */
+  static int use_sha_ni = -1;
+
+  if (use_sha_ni < 0) {
+    use_sha_ni = 0;
+    if (sha256_cpu_has_sha_ni()) {
+      if (SHA256_transform_ni_self_test()) {
+        use_sha_ni = 1;
+      } else {
+        avb_error("SHA-NI self-test failed, using portable SHA-256.\n");
+      }
+    }
+  }
+
+  return use_sha_ni == 1;
+}
+#endif /* AVB_SHA256_SHA_NI */
+
+static void SHA256_transform(AvbSHA256Ctx* ctx,
+                             const uint8_t* message,
+                             size_t block_nb) {
+#ifdef AVB_SHA256_SHA_NI
+  if (sha256_use_sha_ni()) {
+    SHA256_transform_ni(ctx->h, message, block_nb);
+    return;
+  }
+#endif
+  SHA256_transform_c(ctx, message, block_nb);
+}
+
 void avb_sha256_update(AvbSHA256Ctx* ctx, const uint8_t* data, size_t len) {
   size_t block_nb;
   size_t new_len, rem_len, tmp_len;
@@ -74,11 +74,42 @@ static inline bool result_should_continue(AvbSlotVerifyResult result) {
   return false;
 }
 
+/* Hashing state used while a partition is streamed by
+ * |read_from_partition_streamed|. Only the first |remaining| bytes
+ * of the partition are covered by the hash descriptor.
+ */
+typedef struct {
+  AvbSHA256Ctx* sha256_ctx;
+  AvbSHA512Ctx* sha512_ctx;
+  uint64_t remaining;
+} HashStream;
+
+static void hash_stream_chunk(void* user, const uint8_t* data, size_t len) {
+  HashStream* hs = (HashStream*)user;
+
+  if (len > hs->remaining) {
+    len = hs->remaining;
+  }
+  if (hs->sha256_ctx != NULL) {
+    avb_sha256_update(hs->sha256_ctx, data, len);
+  } else {
+    avb_sha512_update(hs->sha512_ctx, data, len);
+  }
+  hs->remaining -= len;
+}
+
+/* Loads the first |image_size| bytes of |part_name|. If |hash_stream|
+ * is not NULL and the partition is read with
+ * |read_from_partition_streamed|, the data is hashed while it is being
+ * read and |out_image_hashed| is set to true.
+ */
 static AvbSlotVerifyResult load_full_partition(AvbOps* ops,
                                                const char* part_name,
                                                uint64_t image_size,
                                                uint8_t** out_image_buf,
-                                               bool* out_image_preloaded) {
+                                               bool* out_image_preloaded,
+                                               HashStream* hash_stream,
+                                               bool* out_image_hashed) {
   size_t part_num_read;
   AvbIOResult io_ret;
 
@@ -120,12 +151,25 @@ static AvbSlotVerifyResult load_full_partition(AvbOps* ops,
       return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     }
 
-    io_ret = ops->read_from_partition(ops,
-                                      part_name,
-                                      0 /* offset */,
-                                      image_size,
-                                      *out_image_buf,
-                                      &part_num_read);
+    if (hash_stream != NULL && ops->read_from_partition_streamed != NULL) {
+      io_ret = ops->read_from_partition_streamed(ops,
+                                                 part_name,
+                                                 image_size,
+                                                 *out_image_buf,
+                                                 &part_num_read,
+                                                 hash_stream_chunk,
+                                                 hash_stream);
+      if (io_ret == AVB_IO_RESULT_OK) {
+        *out_image_hashed = true;
+      }
+    } else {
+      io_ret = ops->read_from_partition(ops,
+                                        part_name,
+                                        0 /* offset */,
+                                        image_size,
+                                        *out_image_buf,
+                                        &part_num_read);
+    }
     if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
       return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
     } else if (io_ret != AVB_IO_RESULT_OK) {
@@ -291,6 +335,10 @@ static AvbSlotVerifyResult load_and_verify_hash_partition(
   AvbIOResult io_ret;
   uint8_t* image_buf = NULL;
   bool image_preloaded = false;
+  bool image_hashed = false;
+  AvbSHA256Ctx sha256_ctx;
+  AvbSHA512Ctx sha512_ctx;
+  HashStream hash_stream = {NULL, NULL, 0};
   uint8_t* digest;
   size_t digest_len;
   const char* found;
@@ -380,31 +428,48 @@ static AvbSlotVerifyResult load_and_verify_hash_partition(
     avb_debugv(part_name, ": Loading entire partition.\n", NULL);
   }
 
-  ret = load_full_partition(
-      ops, part_name, image_size, &image_buf, &image_preloaded);
-  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
-    goto out;
-  }
-
+  /* The hash is set up before loading the partition so that the data
+   * can be hashed while it is being read.
+   */
   if (avb_strcmp((const char*)hash_desc.hash_algorithm, "sha256") == 0) {
-    AvbSHA256Ctx sha256_ctx;
     avb_sha256_init(&sha256_ctx);
     avb_sha256_update(&sha256_ctx, desc_salt, hash_desc.salt_len);
-    avb_sha256_update(&sha256_ctx, image_buf, hash_desc.image_size);
-    digest = avb_sha256_final(&sha256_ctx);
+    hash_stream.sha256_ctx = &sha256_ctx;
     digest_len = AVB_SHA256_DIGEST_SIZE;
   } else if (avb_strcmp((const char*)hash_desc.hash_algorithm, "sha512") == 0) {
-    AvbSHA512Ctx sha512_ctx;
     avb_sha512_init(&sha512_ctx);
     avb_sha512_update(&sha512_ctx, desc_salt, hash_desc.salt_len);
-    avb_sha512_update(&sha512_ctx, image_buf, hash_desc.image_size);
-    digest = avb_sha512_final(&sha512_ctx);
+    hash_stream.sha512_ctx = &sha512_ctx;
     digest_len = AVB_SHA512_DIGEST_SIZE;
   } else {
     avb_errorv(part_name, ": Unsupported hash algorithm.\n", NULL);
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
     goto out;
   }
+  hash_stream.remaining = hash_desc.image_size;
+
+  ret = load_full_partition(ops,
+                            part_name,
+                            image_size,
+                            &image_buf,
+                            &image_preloaded,
+                            &hash_stream,
+                            &image_hashed);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+    goto out;
+  }
+
+  if (hash_stream.sha256_ctx != NULL) {
+    if (!image_hashed) {
+      avb_sha256_update(&sha256_ctx, image_buf, hash_desc.image_size);
+    }
+    digest = avb_sha256_final(&sha256_ctx);
+  } else {
+    if (!image_hashed) {
+      avb_sha512_update(&sha512_ctx, image_buf, hash_desc.image_size);
+    }
+    digest = avb_sha512_final(&sha512_ctx);
+  }
 
   if (hash_desc.digest_len == 0) {
     /* Expect a match to a persistent digest. */
@@ -508,8 +573,13 @@ static AvbSlotVerifyResult load_requested_partitions(
     }
     avb_debugv(part_name, ": Loading entire partition.\n", NULL);
 
-    ret = load_full_partition(
-        ops, part_name, image_size, &image_buf, &image_preloaded);
+    ret = load_full_partition(ops,
+                              part_name,
+                              image_size,
+                              &image_buf,
+                              &image_preloaded,
+                              NULL /* hash_stream */,
+                              NULL /* out_image_hashed */);
     if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
       goto out;
     }
@@ -132,6 +132,12 @@ size_t avb_strlen(const char* str) AVB_ATTR_WARN_UNUSED_RESULT;
  * remainder. */
 uint32_t avb_div_by_10(uint64_t* dividend);
 
+#if defined(__x86_64__) || defined(__i386__)
+/* Executes the CPUID instruction for |leaf|, sub-leaf 0, and stores
+ * EAX, EBX, ECX and EDX in |reg|. */
+void avb_cpuid(uint32_t leaf, uint32_t reg[4]);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,8 +26,10 @@
 #include <efilib.h>
 #include "uefi_avb_ops.h"
 #include "uefi_avb_util.h"
+#include "libavb/avb_sha.h"
 #include "vars.h"
 #include "gpt.h"
+#include "storage_io.h"
 #include "lib.h"
 #include "log.h"
 #include "security.h"
@@ -38,7 +40,63 @@ extern char _binary_avb_pk_end;
 #define avb_pk (&_binary_avb_pk_start)
 #define avb_pk_size ((size_t)&_binary_avb_pk_end - (size_t)&_binary_avb_pk_start)
 
-static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
+/* Resolve |partition_name| into |gpart|.  libavb issues many small
+ * reads per partition, so the GPT lookups are cached in the AvbOps
+ * until the GPT changes.
+ */
+static AvbIOResult get_partition(AvbOps* ops,
+                                 const char* partition_name,
+                                 struct gpt_partition_interface* gpart) {
+  UEFIAvbOpsData* data = ops->user_data;
+  UEFIAvbPartition* cached;
+  EFI_STATUS efi_ret;
+  const CHAR16* label;
+  size_t i, len;
+
+  if (data->gpt_generation == gpt_get_generation()) {
+    for (i = 0; i < UEFI_AVB_PARTITION_CACHE_SIZE; i++) {
+      cached = &data->partitions[i];
+      if (cached->name[0] && !avb_strcmp(cached->name, partition_name)) {
+        avb_memcpy(gpart, &cached->gpart, sizeof(*gpart));
+        return AVB_IO_RESULT_OK;
+      }
+    }
+  }
+
+  label = stra_to_str((const CHAR8 *)partition_name);
+  if (!label) {
+    error(L"out of memory");
+    return AVB_IO_RESULT_ERROR_OOM;
+  }
+
+  efi_ret = gpt_get_partition_by_label(label, gpart, LOGICAL_UNIT_USER);
+  if (EFI_ERROR(efi_ret)) {
+    error(L"Partition %s not found", label);
+    FreePool((VOID *)label);
+    return AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
+  }
+  FreePool((VOID *)label);
+
+  /* The lookup itself may have (re)loaded the GPT. */
+  if (data->gpt_generation != gpt_get_generation()) {
+    avb_memset(data->partitions, 0, sizeof(data->partitions));
+    data->next_partition = 0;
+    data->gpt_generation = gpt_get_generation();
+  }
+
+  len = avb_strlen(partition_name);
+  if (len >= sizeof(cached->name))
+    return AVB_IO_RESULT_OK;
+
+  cached = &data->partitions[data->next_partition];
+  data->next_partition = (data->next_partition + 1) % UEFI_AVB_PARTITION_CACHE_SIZE;
+  avb_memcpy(cached->name, partition_name, len + 1);
+  avb_memcpy(&cached->gpart, gpart, sizeof(*gpart));
+
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult read_from_partition(AvbOps* ops,
                                        const char* partition_name,
                                        int64_t offset_from_partition,
                                        size_t num_bytes,
@@ -48,25 +106,14 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   EFI_STATUS efi_ret;
   struct gpt_partition_interface gpart;
   int64_t partition_size;
-  const CHAR16 *label;
 
   avb_assert(partition_name != NULL);
   avb_assert(buf != NULL);
   avb_assert(out_num_read != NULL);
 
-  label = stra_to_str((const CHAR8 *)partition_name);
-
-  if (!label) {
-    error(L"out of memory");
-    return AVB_IO_RESULT_ERROR_OOM;
-  }
-
-  efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
-  if (EFI_ERROR(efi_ret)) {
-    error(L"Partition %s not found", label);
-    ret = AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
-    goto failed;
-  }
+  ret = get_partition(ops, partition_name, &gpart);
+  if (ret != AVB_IO_RESULT_OK)
+    return ret;
 
   partition_size =
       (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
@@ -75,8 +122,7 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   if (offset_from_partition < 0) {
     if ((-offset_from_partition) > partition_size) {
       avb_error("Offset outside range.\n");
-      ret = AVB_IO_RESULT_ERROR_RANGE_OUTSIDE_PARTITION;
-      goto failed;
+      return AVB_IO_RESULT_ERROR_RANGE_OUTSIDE_PARTITION;
     }
     offset_from_partition = partition_size - (-offset_from_partition);
   }
@@ -101,18 +147,319 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   if (EFI_ERROR(efi_ret)) {
     avb_error("Could not read from Disk.\n");
     *out_num_read = 0;
-    ret = AVB_IO_RESULT_ERROR_IO;
-    goto failed;
+    return AVB_IO_RESULT_ERROR_IO;
   }
-  FreePool((VOID *)label);
+
   return AVB_IO_RESULT_OK;
+}
+
+/* Keep up to STORAGE_IO_DEPTH chunks in flight and hand each chunk
+ * to CHUNK_DONE as soon as it has landed, so that the caller works on
+ * it while the next ones are being read.  */
+static AvbIOResult read_from_partition_streamed(
+    AvbOps* ops,
+    const char* partition_name,
+    size_t num_bytes,
+    void* buf,
+    size_t* out_num_read,
+    void (*chunk_done)(void* user, const uint8_t* data, size_t len),
+    void* user) {
+  AvbIOResult ret = AVB_IO_RESULT_OK;
+  EFI_STATUS efi_ret;
+  struct gpt_partition_interface gpart;
+  struct storage_io *io;
+  uint64_t partition_size, start;
+  size_t queued, done, size;
+
+  avb_assert(partition_name != NULL);
+  avb_assert(buf != NULL);
+  avb_assert(out_num_read != NULL);
+  avb_assert(chunk_done != NULL);
+
+  ret = get_partition(ops, partition_name, &gpart);
+  if (ret != AVB_IO_RESULT_OK)
+    return ret;
+
+  partition_size =
+      (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
+      gpart.bio->Media->BlockSize;
+  if (num_bytes > partition_size)
+    num_bytes = partition_size;
+  start = vm_offset + gpart.part.starting_lba * gpart.bio->Media->BlockSize;
+
+  efi_ret = storage_io_open(&gpart, &io);
+  if (EFI_ERROR(efi_ret))
+    return AVB_IO_RESULT_ERROR_OOM;
+
+  for (queued = 0, done = 0; done < num_bytes;) {
+    while (queued < num_bytes &&
+           queued - done < STORAGE_IO_DEPTH * STORAGE_IO_CHUNK) {
+      size = min(num_bytes - queued, (size_t)STORAGE_IO_CHUNK);
+      efi_ret = storage_io_read(io, start + queued, size, (uint8_t *)buf + queued);
+      if (EFI_ERROR(efi_ret))
+        goto out;
+      queued += size;
+    }
+
+    efi_ret = storage_io_wait(io);
+    if (EFI_ERROR(efi_ret))
+      goto out;
+
+    size = min(num_bytes - done, (size_t)STORAGE_IO_CHUNK);
+    chunk_done(user, (uint8_t *)buf + done, size);
+    done += size;
+  }
+
+out:
+  if (EFI_ERROR(storage_io_close(io)) || EFI_ERROR(efi_ret)) {
+    avb_error("Could not read from Disk.\n");
+    *out_num_read = 0;
+    ret = AVB_IO_RESULT_ERROR_IO;
+  } else
+    *out_num_read = num_bytes;
 
-failed:
-  FreePool((VOID *)label);
   return ret;
 }
 
-static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
+/* Partitions whose content is already in memory, see
+ * uefi_avb_register_preloaded_partition().
+ */
+#define MAX_PRELOADED_PARTITIONS 4
+#define PRELOADED_NAME_MAX_SIZE 32
+#define PRELOADED_VBMETA_MAX_SIZE (64 * 1024)
+
+static struct {
+  char name[PRELOADED_NAME_MAX_SIZE];
+  char ab_suffix[PRELOADED_NAME_MAX_SIZE];
+  uint8_t* buf;
+  size_t size;
+} preloaded[MAX_PRELOADED_PARTITIONS];
+
+bool uefi_avb_register_preloaded_partition(const char* partition_name,
+                                           const char* ab_suffix,
+                                           uint8_t* buf,
+                                           size_t size) {
+  size_t i, len, suffix_len;
+
+  avb_assert(partition_name != NULL);
+  avb_assert(ab_suffix != NULL);
+  avb_assert(buf != NULL);
+
+  len = avb_strlen(partition_name);
+  suffix_len = avb_strlen(ab_suffix);
+  if (len + suffix_len >= PRELOADED_NAME_MAX_SIZE)
+    return false;
+
+  uefi_avb_unregister_preloaded_partition(partition_name, ab_suffix);
+  for (i = 0; i < MAX_PRELOADED_PARTITIONS; i++) {
+    if (preloaded[i].buf)
+      continue;
+    avb_memcpy(preloaded[i].name, partition_name, len);
+    avb_memcpy(preloaded[i].name + len, ab_suffix, suffix_len + 1);
+    avb_memcpy(preloaded[i].ab_suffix, ab_suffix, suffix_len + 1);
+    preloaded[i].buf = buf;
+    preloaded[i].size = size;
+    return true;
+  }
+
+  return false;
+}
+
+void uefi_avb_unregister_preloaded_partition(const char* partition_name,
+                                             const char* ab_suffix) {
+  size_t i, len;
+
+  len = avb_strlen(partition_name);
+  for (i = 0; i < MAX_PRELOADED_PARTITIONS; i++) {
+    if (preloaded[i].buf &&
+        !avb_memcmp(preloaded[i].name, partition_name, len) &&
+        !avb_strcmp(preloaded[i].name + len, ab_suffix)) {
+      preloaded[i].buf = NULL;
+      preloaded[i].size = 0;
+    }
+  }
+}
+
+typedef struct {
+  const char* name;
+  const char* ab_suffix;
+  const uint8_t* buf;
+  size_t size;
+  bool found;
+  bool match;
+} PreloadedMatch;
+
+/* Checks the preloaded image against the hash descriptor of its
+ * partition, if |descriptor| is that one.
+ */
+static bool preloaded_match_descriptor(const AvbDescriptor* descriptor,
+                                       void* user_data) {
+  PreloadedMatch* m = user_data;
+  AvbHashDescriptor desc;
+  const uint8_t* desc_name;
+  const uint8_t* desc_salt;
+  const uint8_t* desc_digest;
+  size_t len;
+  AvbSHA256Ctx sha256_ctx;
+  AvbSHA512Ctx sha512_ctx;
+  uint8_t* digest;
+  size_t digest_len;
+
+  if (avb_be64toh(descriptor->tag) != AVB_DESCRIPTOR_TAG_HASH)
+    return true;
+  if (!avb_hash_descriptor_validate_and_byteswap(
+          (const AvbHashDescriptor*)descriptor, &desc))
+    return true;
+
+  desc_name = (const uint8_t*)descriptor + sizeof(AvbHashDescriptor);
+  desc_salt = desc_name + desc.partition_name_len;
+  desc_digest = desc_salt + desc.salt_len;
+
+  len = desc.partition_name_len;
+  if (avb_strlen(m->name) < len || avb_memcmp(m->name, desc_name, len))
+    return true;
+  if (avb_strcmp(m->name + len,
+                 (desc.flags & AVB_HASH_DESCRIPTOR_FLAGS_DO_NOT_USE_AB) ?
+                     "" : m->ab_suffix))
+    return true;
+
+  m->found = true;
+  if (desc.digest_len == 0 || desc.image_size > m->size)
+    return false;
+
+  if (avb_strcmp((const char*)desc.hash_algorithm, "sha256") == 0) {
+    avb_sha256_init(&sha256_ctx);
+    avb_sha256_update(&sha256_ctx, desc_salt, desc.salt_len);
+    avb_sha256_update(&sha256_ctx, m->buf, desc.image_size);
+    digest = avb_sha256_final(&sha256_ctx);
+    digest_len = AVB_SHA256_DIGEST_SIZE;
+  } else if (avb_strcmp((const char*)desc.hash_algorithm, "sha512") == 0) {
+    avb_sha512_init(&sha512_ctx);
+    avb_sha512_update(&sha512_ctx, desc_salt, desc.salt_len);
+    avb_sha512_update(&sha512_ctx, m->buf, desc.image_size);
+    digest = avb_sha512_final(&sha512_ctx);
+    digest_len = AVB_SHA512_DIGEST_SIZE;
+  } else {
+    return false;
+  }
+
+  m->match = digest_len == desc.digest_len &&
+             avb_safe_memcmp(digest, desc_digest, digest_len) == 0;
+  return false;
+}
+
+/* Reads |size| bytes at |offset| of |partition| and looks for the
+ * hash descriptor of the preloaded image in this vbmeta image.
+ */
+static void preloaded_match_vbmeta(AvbOps* ops,
+                                   const char* partition,
+                                   int64_t offset,
+                                   size_t size,
+                                   PreloadedMatch* m) {
+  AvbVBMetaVerifyResult verify_ret;
+  uint8_t* vbmeta;
+  size_t num_read;
+
+  if (size < AVB_VBMETA_IMAGE_HEADER_SIZE || size > PRELOADED_VBMETA_MAX_SIZE)
+    return;
+
+  vbmeta = avb_malloc(size);
+  if (!vbmeta)
+    return;
+
+  if (ops->read_from_partition(ops, partition, offset, size, vbmeta,
+                               &num_read) != AVB_IO_RESULT_OK ||
+      num_read < AVB_VBMETA_IMAGE_HEADER_SIZE)
+    goto out;
+
+  /* The signature itself is checked by avb_slot_verify(). */
+  verify_ret = avb_vbmeta_image_verify(vbmeta, num_read, NULL, NULL);
+  if (verify_ret != AVB_VBMETA_VERIFY_RESULT_OK &&
+      verify_ret != AVB_VBMETA_VERIFY_RESULT_OK_NOT_SIGNED)
+    goto out;
+
+  avb_descriptor_foreach(vbmeta, num_read, preloaded_match_descriptor, m);
+
+out:
+  avb_free(vbmeta);
+}
+
+/* Only an image described by the vbmeta on disk is used in place: the
+ * hash descriptor of the partition is looked up in the vbmeta
+ * partition, then in the footer of the partition itself for a chained
+ * partition.
+ */
+static bool preloaded_matches_disk(AvbOps* ops,
+                                   const char* name,
+                                   const char* ab_suffix,
+                                   const uint8_t* buf,
+                                   size_t size) {
+  PreloadedMatch m = {name, ab_suffix, buf, size, false, false};
+  char vbmeta_name[PRELOADED_NAME_MAX_SIZE + sizeof("vbmeta")];
+  uint8_t footer_buf[AVB_FOOTER_SIZE];
+  AvbFooter footer;
+  size_t num_read;
+
+  if (!avb_str_concat(vbmeta_name, sizeof(vbmeta_name), "vbmeta",
+                      avb_strlen("vbmeta"), ab_suffix, avb_strlen(ab_suffix)))
+    return false;
+
+  preloaded_match_vbmeta(ops, vbmeta_name, 0, PRELOADED_VBMETA_MAX_SIZE, &m);
+  if (m.found)
+    return m.match;
+
+  if (ops->read_from_partition(ops, name, -AVB_FOOTER_SIZE, AVB_FOOTER_SIZE,
+                               footer_buf, &num_read) != AVB_IO_RESULT_OK ||
+      num_read != AVB_FOOTER_SIZE ||
+      !avb_footer_validate_and_byteswap((const AvbFooter*)footer_buf, &footer))
+    return false;
+
+  preloaded_match_vbmeta(ops, name, footer.vbmeta_offset, footer.vbmeta_size,
+                         &m);
+  return m.found && m.match;
+}
+
+/* Hand the registered buffer to libavb without any copy, provided it
+ * is the image the on-disk vbmeta describes.  Otherwise, libavb reads
+ * the partition.  A registered buffer stands for the whole partition:
+ * one shorter than the |num_bytes| requested is an I/O error.
+ */
+static AvbIOResult get_preloaded_partition(AvbOps* ops,
+                                           const char* partition,
+                                           size_t num_bytes,
+                                           uint8_t** out_pointer,
+                                           size_t* out_num_bytes_preloaded) {
+  size_t i;
+
+  avb_assert(partition != NULL);
+  avb_assert(out_pointer != NULL);
+  avb_assert(out_num_bytes_preloaded != NULL);
+
+  *out_pointer = NULL;
+  *out_num_bytes_preloaded = 0;
+
+  for (i = 0; i < MAX_PRELOADED_PARTITIONS; i++) {
+    if (!preloaded[i].buf || avb_strcmp(preloaded[i].name, partition))
+      continue;
+    if (preloaded[i].size < num_bytes) {
+      avb_errorv(partition, ": Preloaded image too short.\n", NULL);
+      return AVB_IO_RESULT_ERROR_IO;
+    }
+    if (!preloaded_matches_disk(ops, preloaded[i].name, preloaded[i].ab_suffix,
+                                preloaded[i].buf, preloaded[i].size)) {
+      avb_debugv(partition, ": Preloaded image not described by vbmeta.\n",
+                 NULL);
+      break;
+    }
+    *out_pointer = preloaded[i].buf;
+    *out_num_bytes_preloaded = num_bytes;
+    break;
+  }
+
+  return AVB_IO_RESULT_OK;
+}
+
+static AvbIOResult write_to_partition(AvbOps* ops,
                                       const char* partition_name,
                                       int64_t offset_from_partition,
                                       size_t num_bytes,
@@ -121,23 +468,13 @@ static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
   EFI_STATUS efi_ret;
   struct gpt_partition_interface gpart;
   uint64_t partition_size;
-  const CHAR16 * label;
 
   avb_assert(partition_name != NULL);
   avb_assert(buf != NULL);
 
-  label = stra_to_str((const CHAR8 *)partition_name);
-  if (!label) {
-    error(L"out of memory");
-    return AVB_IO_RESULT_ERROR_OOM;
-  }
-
-  efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
-  if (EFI_ERROR(efi_ret)) {
-    error(L"Partition %s not found", label);
-    ret = AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
-    goto failed;
-  }
+  ret = get_partition(ops, partition_name, &gpart);
+  if (ret != AVB_IO_RESULT_OK)
+    return ret;
 
   partition_size =
       (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
@@ -146,8 +483,7 @@ static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
   if (offset_from_partition < 0) {
     if ((-offset_from_partition) > (int)partition_size) {
       avb_error("Offset outside range.\n");
-      ret = AVB_IO_RESULT_ERROR_RANGE_OUTSIDE_PARTITION;
-      goto failed;
+      return AVB_IO_RESULT_ERROR_RANGE_OUTSIDE_PARTITION;
     }
     offset_from_partition = partition_size - (-offset_from_partition);
   }
@@ -157,8 +493,7 @@ static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
    */
   if (num_bytes > partition_size - offset_from_partition) {
     avb_error("Cannot write beyond partition boundary.\n");
-    ret = AVB_IO_RESULT_ERROR_RANGE_OUTSIDE_PARTITION;
-    goto failed;
+    return AVB_IO_RESULT_ERROR_RANGE_OUTSIDE_PARTITION;
   }
 
   efi_ret = uefi_call_wrapper(
@@ -173,39 +508,24 @@ static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
 
   if (EFI_ERROR(efi_ret)) {
     avb_error("Could not write to Disk.\n");
-    ret = AVB_IO_RESULT_ERROR_IO;
-    goto failed;
+    return AVB_IO_RESULT_ERROR_IO;
   }
-  FreePool((VOID *)label);
-  return AVB_IO_RESULT_OK;
 
-failed:
-  FreePool((VOID *)label);
-  return ret;
+  return AVB_IO_RESULT_OK;
 }
 
-static AvbIOResult get_size_of_partition(__attribute__((unused)) AvbOps* ops,
+static AvbIOResult get_size_of_partition(AvbOps* ops,
                                          const char* partition_name,
                                          uint64_t* out_size) {
-  EFI_STATUS efi_ret;
+  AvbIOResult ret;
   struct gpt_partition_interface gpart;
   uint64_t partition_size;
-  const CHAR16 * label;
 
   avb_assert(partition_name != NULL);
 
-  label = stra_to_str((const CHAR8 *)partition_name);
-  if (!label) {
-    error(L"out of memory");
-    return AVB_IO_RESULT_ERROR_OOM;
-  }
-
-  efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
-  if (EFI_ERROR(efi_ret)) {
-    error(L"Partition %s not found", label);
-    FreePool((VOID *)label);
-    return AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
-  }
+  ret = get_partition(ops, partition_name, &gpart);
+  if (ret != AVB_IO_RESULT_OK)
+    return ret;
 
   partition_size =
       (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
@@ -214,7 +534,6 @@ static AvbIOResult get_size_of_partition(__attribute__((unused)) AvbOps* ops,
   if (out_size != NULL) {
     *out_size = partition_size;
   }
-  FreePool((VOID *)label);
   return AVB_IO_RESULT_OK;
 }
 
@@ -400,6 +719,8 @@ AvbOps* uefi_avb_ops_new(void) {
   data->block_io = gparti.bio;
   data->disk_io  = gparti.dio;
   data->ops.read_from_partition = read_from_partition;
+  data->ops.read_from_partition_streamed = read_from_partition_streamed;
+  data->ops.get_preloaded_partition = get_preloaded_partition;
   data->ops.write_to_partition = write_to_partition;
   data->ops.get_size_of_partition = get_size_of_partition;
   data->ops.validate_vbmeta_public_key = validate_vbmeta_public_key;
@@ -27,12 +27,28 @@
 
 #include <efi.h>
 #include "libavb/libavb.h"
+#include "gpt.h"
+
+/* Number of partitions whose GPT entry is kept by an AvbOps. */
+#define UEFI_AVB_PARTITION_CACHE_SIZE 16
+
+typedef struct UEFIAvbPartition {
+  char name[GPT_NAME_LEN];
+  struct gpt_partition_interface gpart;
+} UEFIAvbPartition;
+
 /* The |user_data| member of AvbOps points to a struct of this type. */
 typedef struct UEFIAvbOpsData {
   AvbOps ops;
   //AVbops_AB ops_ab;
   EFI_BLOCK_IO* block_io;
   EFI_DISK_IO* disk_io;
+  /* GPT entries resolved by name, valid as long as the GPT
+   * generation they have been resolved in is current.
+   */
+  UEFIAvbPartition partitions[UEFI_AVB_PARTITION_CACHE_SIZE];
+  size_t next_partition;
+  UINT32 gpt_generation;
 } UEFIAvbOpsData;
 
 /* Returns an AvbOps for use with UEFI. */
@@ -41,4 +57,29 @@ AvbOps* uefi_avb_ops_new(void);
 /* Frees the AvbOps allocated with uefi_avb_ops_new(). */
 void uefi_avb_ops_free(AvbOps* ops);
 
+/* Registers |size| bytes at |buf| as the content of partition
+ * |partition_name| of slot |ab_suffix| ("" if none). libavb then uses
+ * |buf| in place instead of allocating a buffer and reading the
+ * partition, as long as the hash descriptor of the partition in the
+ * on-disk vbmeta matches |buf|. |buf| stands for the whole data libavb
+ * loads: if it is shorter, the verification fails with an I/O error.
+ * |buf| must outlive the AvbSlotVerifyData produced while it is
+ * registered. Returns false if the registry is full.
+ */
+bool uefi_avb_register_preloaded_partition(const char* partition_name,
+                                           const char* ab_suffix,
+                                           uint8_t* buf,
+                                           size_t size);
+
+/* Removes a registration made with uefi_avb_register_preloaded_partition(). */
+void uefi_avb_unregister_preloaded_partition(const char* partition_name,
+                                             const char* ab_suffix);
+
+/* Returns the size of |ptr| if it is a page aligned buffer allocated
+ * by avb_malloc(), including the room left after the requested size,
+ * or 0 otherwise. The partition images loaded by libavb are allocated
+ * this way so that their ramdisk can be handed to the kernel in place.
+ */
+size_t uefi_avb_buffer_size(const void* ptr);
+
 #endif /* UEFI_AVB_OPS_H_ */
@@ -28,6 +28,7 @@
 
 #include <libavb/libavb.h>
 
+#include "uefi_avb_ops.h"
 #include "uefi_avb_util.h"
 #include "lib.h"
 #include "log.h"
@@ -105,10 +106,79 @@ void avb_printv_ui(const char* message, ...) {
 }
 #endif
 
+/* Partition images are allocated in whole pages below 4 GiB with
+ * some room after them.  The boot code can then hand their ramdisk
+ * sections to the kernel in place, appending the other ramdisk parts
+ * after the vendor ramdisk instead of copying it.
+ */
+#define AVB_PAGES_MIN_SIZE (1024 * 1024)
+#define AVB_PAGES_ROOM (8 * 1024 * 1024)
+#define AVB_PAGES_MAX_ADDRESS 0xffffffff
+#define AVB_PAGES_MAX_ALLOCS 16
+
+static struct {
+  void* ptr;
+  size_t size;
+} page_allocs[AVB_PAGES_MAX_ALLOCS];
+
+static void* avb_malloc_pages(size_t size) {
+  EFI_PHYSICAL_ADDRESS addr = AVB_PAGES_MAX_ADDRESS;
+  EFI_STATUS err;
+  size_t i;
+
+  for (i = 0; i < AVB_PAGES_MAX_ALLOCS; i++)
+    if (!page_allocs[i].ptr)
+      break;
+  if (i == AVB_PAGES_MAX_ALLOCS)
+    return NULL;
+
+  size = EFI_SIZE_TO_PAGES(size + AVB_PAGES_ROOM) << EFI_PAGE_SHIFT;
+  err = uefi_call_wrapper(BS->AllocatePages, 4, AllocateMaxAddress,
+                          EfiLoaderData, EFI_SIZE_TO_PAGES(size), &addr);
+  if (EFI_ERROR(err))
+    return NULL;
+
+  page_allocs[i].ptr = (void*)(UINTN)addr;
+  page_allocs[i].size = size;
+  return page_allocs[i].ptr;
+}
+
+static bool avb_free_pages(void* ptr) {
+  size_t i;
+
+  for (i = 0; i < AVB_PAGES_MAX_ALLOCS; i++) {
+    if (page_allocs[i].ptr != ptr)
+      continue;
+    uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(UINTN)ptr,
+                      EFI_SIZE_TO_PAGES(page_allocs[i].size));
+    page_allocs[i].ptr = NULL;
+    page_allocs[i].size = 0;
+    return true;
+  }
+
+  return false;
+}
+
+size_t uefi_avb_buffer_size(const void* ptr) {
+  size_t i;
+
+  for (i = 0; i < AVB_PAGES_MAX_ALLOCS; i++)
+    if (ptr && page_allocs[i].ptr == ptr)
+      return page_allocs[i].size;
+
+  return 0;
+}
+
 void* avb_malloc_(size_t size) {
   EFI_STATUS err;
   void* x;
 
+  if (size >= AVB_PAGES_MIN_SIZE) {
+    x = avb_malloc_pages(size);
+    if (x)
+      return x;
+  }
+
   err = uefi_call_wrapper(
       BS->AllocatePool, 3, EfiBootServicesData, (UINTN)size, &x);
   if (EFI_ERROR(err)) {
@@ -120,6 +190,10 @@ void* avb_malloc_(size_t size) {
 
 void avb_free(void* ptr) {
   EFI_STATUS err;
+
+  if (avb_free_pages(ptr))
+    return;
+
   err = uefi_call_wrapper(BS->FreePool, 1, ptr);
 
   if (EFI_ERROR(err)) {
@@ -137,3 +211,9 @@ uint32_t avb_div_by_10(uint64_t* dividend) {
   *dividend /= 10;
   return rem;
 }
+
+#if defined(__x86_64__) || defined(__i386__)
+void avb_cpuid(uint32_t leaf, uint32_t reg[4]) {
+  cpuid(leaf, reg);
+}
+#endif
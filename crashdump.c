@@ -38,6 +38,8 @@
 #include "uefi_utils.h"
 #include "security_interface.h"
 #include "crashdump.h"
+#include "storage.h"
+#include "timer.h"
 
 BOOLEAN tee_tpm = 0;
 BOOLEAN andr_tpm = 0;
@@ -57,6 +59,18 @@ void __attribute__((weak)) part_select(int num)
 	(void)num;
 }
 
+/* Size of the writes issued for the RAM regions.  Large writes let
+ * the storage driver build long transfers instead of paying a command
+ * round trip every few blocks.  */
+#define DUMP_WRITE_SIZE (16 * 1024 * 1024)
+
+/* Number of blocks of the bounce buffer used for the sources which do
+ * not meet the I/O alignment requirement of the device.  */
+#define BOUNCE_BLOCKS 2048
+
+static VOID *bounce_buf;
+static VOID *bounce_aligned;
+
 EFI_STATUS flash_write(VOID *data, UINTN size)
 {
 	EFI_STATUS ret;
@@ -77,40 +91,68 @@ EFI_STATUS flash_write(VOID *data, UINTN size)
 	}
 
 	cur_offset += size;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS flash_flush(void)
+{
+	EFI_STATUS ret;
+
 	ret = uefi_call_wrapper(gparti.bio->FlushBlocks, 1, gparti.bio);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to flush the dump partition");
 
 	return ret;
 }
 
+static BOOLEAN is_io_aligned(VOID *data)
+{
+	UINT32 align = gparti.bio->Media->IoAlign;
+
+	return align <= 1 || (UINTN)data % align == 0;
+}
+
 EFI_STATUS flash_write_as_block(VOID *data, UINTN size)
 {
-	EFI_STATUS ret;
-	UINT32 *aligned_buf;
-	VOID *buf;
+	EFI_STATUS ret = EFI_SUCCESS;
 	UINTN buf_size, write_size;
 
 	if (!gparti.bio || !size || size % gparti.bio->Media->BlockSize)
 		return EFI_INVALID_PARAMETER;
 
-	// the N_BLOCK is 4096, to save the allocate heap, here reduce to 2048
-	buf_size = min(gparti.bio->Media->BlockSize * 2048, size);
-	ret = alloc_aligned(&buf, (VOID **)&aligned_buf, buf_size, gparti.bio->Media->IoAlign);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Unable to allocate the buf");
-		return ret;
+	/* Memory is written in place when the device can DMA from it */
+	if (is_io_aligned(data)) {
+		for (; size; size -= write_size) {
+			write_size = min(size, (UINTN)DUMP_WRITE_SIZE);
+			ret = flash_write(data, write_size);
+			if (EFI_ERROR(ret))
+				return ret;
+			data += write_size;
+		}
+		return EFI_SUCCESS;
+	}
+
+	buf_size = gparti.bio->Media->BlockSize * BOUNCE_BLOCKS;
+	if (!bounce_buf) {
+		ret = alloc_aligned(&bounce_buf, &bounce_aligned, buf_size,
+				    gparti.bio->Media->IoAlign);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Unable to allocate the buf");
+			return ret;
+		}
 	}
 
 	for (; size; size -= write_size) {
 		write_size = min(size, buf_size);
-		memcpy(aligned_buf,data,write_size);
-		ret = flash_write(aligned_buf, write_size);
+		memcpy(bounce_aligned, data, write_size);
+		ret = flash_write(bounce_aligned, write_size);
 		if (EFI_ERROR(ret))
-			goto out;
-		data +=write_size;
+			return ret;
+		data += write_size;
 	}
-out:
-	FreePool(buf);
-	return ret;
+
+	return EFI_SUCCESS;
 }
 
 EFI_STATUS crashdump_to_partition(EFI_GUID * uuid)
@@ -123,6 +165,8 @@ EFI_STATUS crashdump_to_partition(EFI_GUID * uuid)
 	CHAR8 *mem_map;
 	dump_hdr_t head;
 	VOID * shm_start = NULL;
+	UINT64 done = 0, total = 0;
+	uint32_t print_sec, print_prev = 0;
 
 	mem_entries = (CHAR8 *)LibMemoryMap(&nr_entries, &key, &entry_sz, &entry_ver);
 	if (!mem_entries) {
@@ -185,15 +229,17 @@ EFI_STATUS crashdump_to_partition(EFI_GUID * uuid)
 	}
 
 
+	for (i = 0; i < head.region_num; i++)
+		total += head.dump_ram_region[i].map_sz;
+	total /= gparti.bio->Media->BlockSize;
+
+	info_n(L"Dumping ");
+	print_sec = boottime_in_msec() / 1000;
 	for (i = 0; i < head.region_num; i++) {
-		int blocks = 0;
 		EFI_PHYSICAL_ADDRESS start = head.dump_ram_region[i].start;
-		UINT64 map_sz = head.dump_ram_region[i].map_sz, len,lba_skip;
+		UINT64 map_sz = head.dump_ram_region[i].map_sz, len;
 		void *buf;
 
-		lba_skip = cur_offset / (UINT64)(gparti.bio->Media->BlockSize) - gparti.part.starting_lba;
-		debug(L"%d",head.region_num-i);
-
 		for (; map_sz > 0; map_sz -= len, start += len) {
 			len = map_sz;
 #ifdef __LP64__
@@ -210,13 +256,16 @@ EFI_STATUS crashdump_to_partition(EFI_GUID * uuid)
 				efi_perror(ret, L"Failed to write dump ram 0x%llx to partition\n",buf);
 				goto err;
 			}
-			log(L".");
-			if (blocks % 16 == 0) {
-				log(L"\n");
-			}
-			blocks ++;
+			done += len / gparti.bio->Media->BlockSize;
+			print_progress(done, total, boottime_in_msec() / 1000, &print_sec, &print_prev);
 		}
 	}
+	print_progress(total, total, boottime_in_msec() / 1000, &print_sec, &print_prev);
+	info_n(L"\n");
+
+	ret = flash_flush();
+	if (EFI_ERROR(ret))
+		goto err;
 	debug(L"Dump done!!");
 
 #ifndef __LP64__
@@ -224,6 +273,10 @@ pae_err:
 		pae_exit();
 #endif
 err:
+	if (bounce_buf) {
+		FreePool(bounce_buf);
+		bounce_buf = NULL;
+	}
 	FreePool((void *)mem_map);
 	//debug(L"PAE exit buf=0x%x, head=0x%x\n",buf,*(UINT32*)buf);
 	return ret;
@@ -76,6 +76,8 @@ void fastboot_info(const char *fmt, ...);
 EFI_STATUS fastboot_info_long_string(char *str, void *context);
 
 EFI_STATUS fastboot_set_command_buffer(char *buffer, UINTN size);
+EFI_STATUS fastboot_stream_flash(CHAR8 *label);
+BOOLEAN fastboot_flash_allowed(CHAR8 *label);
 EFI_STATUS fastboot_start(void **bootimage, void **efiimage,
 			  UINTN *imagesize, enum boot_target *target);
 EFI_STATUS fastboot_stop(void *bootimage, void *efiimage, UINTN imagesize,
@@ -78,7 +78,8 @@ typedef struct fat_fs {
 typedef struct fatsystem {
 	struct gpt_partition_interface parti;
 	FATFS fatfs;
-	UINT32 bpb_offset;
+	UINT64 bpb_offset;
+	UINT64 part_size;
 } FATSYSTEM;
 
 typedef struct fatfs_fsobj {
@@ -95,9 +96,10 @@ typedef struct fatfs_fsobj {
 	UINT16 FstClusLO;
 	UINT16 FileSize;
 } FATFS_FSOBJ;
-EFI_STATUS fat_readdisk(UINT32 offset, UINT32 len, void *data);
-EFI_STATUS fat_writedisk(UINT32 offset, UINT32 len, void *data);
-UINT32 fat_getbpb_offset();
+EFI_STATUS fat_readdisk(UINT64 offset, UINTN len, void *data);
+EFI_STATUS fat_writedisk(UINT64 offset, UINTN len, void *data);
+UINT64 fat_getbpb_offset();
+UINT64 fat_getpart_size();
 EFI_STATUS fat_init();
 VOID debug_hex(UINT32 offset, CHAR8 *data, UINT16 size);
 EFI_STATUS flash_fwupdate(VOID *data, UINTN size);
@@ -39,6 +39,11 @@
 
 EFI_STATUS log_flush_to_var(BOOLEAN nonvol);
 
+/* Send the messages buffered in deferred mode to the serial port.  */
+void log_drain(void);
+/* Number of bytes overwritten before log_drain() could send them.  */
+UINT64 log_get_dropped(void);
+
 void log(const CHAR16 *fmt, ...);
 void vlog(const CHAR16 *fmt, va_list args);
 
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2024, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef _STORAGE_IO_H_
+#define _STORAGE_IO_H_
+
+#include <efi.h>
+#include "gpt.h"
+
+/* Number of requests kept in flight when the firmware provides
+ * EFI_DISK_IO2_PROTOCOL.  */
+#define STORAGE_IO_DEPTH	4
+
+/* storage_read() and storage_write() split transfers in chunks of
+ * this size so that several of them can be queued at once.  */
+#define STORAGE_IO_CHUNK	(1024 * 1024)
+
+struct storage_io;
+
+/* Open an I/O queue on the disk GPARTI belongs to.  Offsets are
+ * absolute disk offsets, as for GPARTI->dio.  If the firmware does not
+ * provide EFI_DISK_IO2_PROTOCOL on this disk, requests are performed
+ * synchronously with EFI_DISK_IO_PROTOCOL.  */
+EFI_STATUS storage_io_open(struct gpt_partition_interface *gparti,
+			   struct storage_io **io_p);
+BOOLEAN storage_io_is_async(struct storage_io *io);
+
+/* Queue a request.  If STORAGE_IO_DEPTH requests are already in
+ * flight, wait for the oldest one first.  BUF must remain valid until
+ * the request has been completed by storage_io_wait() or
+ * storage_io_close().  */
+EFI_STATUS storage_io_read(struct storage_io *io, UINT64 offset,
+			   UINTN size, VOID *buf);
+EFI_STATUS storage_io_write(struct storage_io *io, UINT64 offset,
+			    UINTN size, VOID *buf);
+
+/* Wait for the oldest request in flight and return its status.
+ * Requests complete in the order they were queued.  */
+EFI_STATUS storage_io_wait(struct storage_io *io);
+
+/* Wait for all the requests in flight.  Return the first error
+ * encountered by one of the requests since IO was opened.  */
+EFI_STATUS storage_io_sync(struct storage_io *io);
+
+/* Wait for all the requests in flight and release IO.  Return the
+ * first error encountered by one of the requests.  */
+EFI_STATUS storage_io_close(struct storage_io *io);
+
+/* Synchronous helpers keeping the controller queue full on large
+ * transfers.  */
+EFI_STATUS storage_read(struct gpt_partition_interface *gparti, UINT64 offset,
+			UINT64 len, VOID *buf);
+EFI_STATUS storage_write(struct gpt_partition_interface *gparti, UINT64 offset,
+			 UINT64 len, VOID *buf);
+
+#endif	/* _STORAGE_IO_H_ */
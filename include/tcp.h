@@ -43,5 +43,8 @@ EFI_STATUS tcp_stop(void);
 EFI_STATUS tcp_run(UINT32 *state);
 EFI_STATUS tcp_read(void *buf, UINT32 size);
 EFI_STATUS tcp_write(void *buf, UINT32 size);
+/* Total number of bytes received by completed tcp_read() requests and
+   TSC ticks spent waiting for them.  */
+void tcp_get_rx_stats(UINT64 *bytes, UINT64 *ticks);
 
 #endif	/* _TCP_H_ */
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2024, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <efi.h>
+
+/* Number of events kept in the trace ring buffer.  Once it is full,
+ * the oldest events are overwritten.  */
+#define TRACE_BUF_SIZE	256
+
+/* Record the beginning or the end of the NAME scope with the current
+ * TSC value.  NAME must be a static string.  */
+void trace_event(const char *name, BOOLEAN begin);
+
+#define TRACE_BEGIN(name)	trace_event(name, TRUE)
+#define TRACE_END(name)		trace_event(name, FALSE)
+
+/* Export the recorded events as a Chrome trace event JSON document
+ * (chrome://tracing, Perfetto).  The returned buffer is
+ * NUL-terminated, LEN does not include the NUL character, and it must
+ * be freed by the caller.  */
+EFI_STATUS trace_to_json(CHAR8 **json, UINTN *len);
+
+#endif	/* _TRACE_H_ */
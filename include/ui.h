@@ -53,9 +53,16 @@ typedef struct image {
 	const char *name;
 	const UINT8 *data;
 	const UINTN size;
+	/* DATA holds pixels run-length encoded by png2c rather than a
+	 * PNG file, WIDTH and HEIGHT are set at build time */
+	BOOLEAN rle;
 	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt;
 	UINTN width;
 	UINTN height;
+	/* Last scaled version, see ui_image_draw_scale() */
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *scaled_blt;
+	UINTN scaled_width;
+	UINTN scaled_height;
 } ui_image_t;
 
 EFI_STATUS ui_image_draw(ui_image_t *image, UINTN x, UINTN y);
@@ -97,6 +104,14 @@ typedef struct ui_textarea {
 	UINTN width;
 	UINTN height;
 	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt;
+	/* Incremental rendering state: per text line dirty flags, number
+	 * of lines scrolled since the last refresh, whether the blt
+	 * holds a complete rendering and whether the screen holds the
+	 * blt. */
+	BOOLEAN *dirty;
+	UINTN scrolled;
+	BOOLEAN rendered;
+	BOOLEAN displayed;
 } ui_textarea_t;
 
 ui_textarea_t *ui_textarea_create(UINTN line_nb, UINTN row_nb, ui_font_t *font,
@@ -118,6 +133,7 @@ void ui_textarea_n(ui_textarea_t *textarea, char *str,
 EFI_STATUS ui_textarea_draw_scale(ui_textarea_t *textarea, UINTN x, UINTN *y,
 				  UINTN width, UINTN height);
 EFI_STATUS ui_textarea_draw(ui_textarea_t *textarea, UINTN x, UINTN y);
+void ui_textarea_invalidate(ui_textarea_t *textarea);
 
 /* EFI Scan codes */
 #ifdef USE_POWER_BUTTON
@@ -189,8 +205,8 @@ void ui_get_scaled_dimension(UINTN orig_width, UINTN orig_heigth,
 			     UINTN max_width, UINTN max_height,
 			     UINTN *width, UINTN *height);
 UINT64 ui_get_blt_size(UINTN width, UINTN height);
-void ui_bilinear_scale(unsigned char *s, unsigned char *d,
-		       int sx, int sy, int dx, int dy,
-		       int depth);
+EFI_STATUS ui_bilinear_scale(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *src,
+			     EFI_GRAPHICS_OUTPUT_BLT_PIXEL *dst,
+			     UINTN sx, UINTN sy, UINTN dx, UINTN dy);
 
 #endif  /* _UI_H_ */
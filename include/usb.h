@@ -48,5 +48,8 @@ EFI_STATUS usb_stop(void);
 EFI_STATUS usb_run(UINT32 *state);
 EFI_STATUS usb_read(void *buf, UINT32 size);
 EFI_STATUS usb_write(void *buf, UINT32 size);
+/* Number of completed Rx requests, total number of bytes received by
+   completed usb_read() buffers and TSC ticks spent receiving them.  */
+void usb_get_rx_stats(UINT64 *completions, UINT64 *bytes, UINT64 *ticks);
 
 #endif	/* _USB_H_ */
@@ -71,6 +71,10 @@ extern const EFI_GUID fastboot_guid;
 /* EFI variable to store the kernelflinger logs.  */
 #define LOG_VAR			L"KernelflingerLogs"
 
+/* EFI variable overriding the serial logging mode: a non-zero value
+ * defers the serial output, zero makes it synchronous.  */
+#define LOG_DEFERRED_VAR	L"LogDeferred"
+
 #ifndef USER
 #define CMDLINE_PREPEND_VAR     L"PrependCmdline"
 #define CMDLINE_APPEND_VAR      L"AppendCmdline"
@@ -41,8 +41,6 @@
 #include "protocol.h"
 #include "flash.h"
 #include "gpt.h"
-#include "sparse.h"
-#include "sparse_format.h"
 #include "fastboot.h"
 #include "fastboot_oem.h"
 #include "text_parser.h"
@@ -205,388 +203,118 @@ static EFI_STATUS read_file(EFI_FILE *file, UINTN size, void *data)
 	return ret;
 }
 
-typedef struct flash_buffer {
-	struct sparse_header sph;
-	struct chunk_header skip_ckh;
-	union {
-		struct chunk_header ckh;
-		char data[1];
-	} d;
-	char ckh_data[1];
-} __attribute__((__packed__)) flash_buffer_t;
-
-/*when flash big chunks and in two image should add read_flags*/
-static EFI_STATUS installer_flash_big_chunk_multiple(EFI_FILE **file, UINTN *read_flags,
-	UINTN file_size, UINTN *remaining_data, flash_buffer_t *fb, UINTN argc, CHAR8 **argv)
+/* Flash the concatenation of the NUM files FILENAME into the ARGV[1]
+   partition through the regular flash command, for the labels which
+   need the whole image at once.  */
+static void installer_buffered_flash(CHAR16 **filename, UINTN *size,
+				     UINTN num, CHAR8 **argv)
 {
-	EFI_STATUS ret = EFI_INVALID_PARAMETER;
-	UINTN payload_size, read_size, already_read, ckh_blks, data_size;
-	const UINTN MAX_DATA_SIZE = dl->max_size - offsetof(flash_buffer_t, ckh_data);
-	const UINTN MAX_BLKS = MAX_DATA_SIZE / fb->sph.blk_sz;
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	struct chunk_header *ckh;
-	void *read_ptr;
-
-	ckh = &fb->d.ckh;
-	payload_size = ckh->total_sz - sizeof(*ckh);
-	fb->sph.total_chunks = 2; /* skip and data chunks. */
-
-	for (ckh_blks = ckh->chunk_sz; ckh_blks; ckh_blks -= ckh->chunk_sz) {
-		ckh->chunk_sz = min(MAX_BLKS, ckh_blks);
-		data_size = (UINTN)ckh->chunk_sz * (UINTN)fb->sph.blk_sz;
-		ckh->total_sz = sizeof(*ckh) + data_size;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz + ckh->chunk_sz;
-		installer_flash_buffer(fb, ckh->total_sz + HEADER_SIZE, argc, argv);
-		if (!last_cmd_succeeded)
-			return EFI_INVALID_PARAMETER;
-
-		payload_size -= data_size;
-		if (!payload_size)
-			break;
-
-		/* Move the incomplete data from the end to the
-		   beginning of the buffer. */
-		read_ptr = fb->ckh_data;
-		read_size = min(payload_size, MAX_DATA_SIZE);
-		if (data_size < MAX_DATA_SIZE) {
-			already_read = MAX_DATA_SIZE - data_size;
-			ret = memcpy_s(read_ptr, MAX_DATA_SIZE, fb->d.data + ckh->total_sz, already_read);
-			if (EFI_ERROR(ret))
-				return ret;
-			read_size -= already_read;
-			read_ptr += already_read;
-			if (read_size > file_size) {
-				ret = read_file(file[*read_flags], file_size, read_ptr);
-				if (EFI_ERROR(ret))
-					return ret;
-				read_size -= file_size;
-				read_ptr += file_size;
-				*remaining_data -= file_size;
-				(*read_flags)++;
-				}
-		}
-		ret = read_file(file[*read_flags], read_size, read_ptr);
-		if (EFI_ERROR(ret))
-			return ret;
-		*remaining_data -= read_size;
-
-		fb->skip_ckh.chunk_sz += ckh->chunk_sz;
-	}
-
-	if (payload_size)
-		return EFI_INVALID_PARAMETER;
-
-	return EFI_SUCCESS;
-}
-
-/* This function splits a chunk too large to fit into a
-   dl->max_size buffer into smaller chunks and flash them. */
-static EFI_STATUS installer_flash_big_chunk(EFI_FILE *file, UINTN *remaining_data,
-					    flash_buffer_t *fb, UINTN argc, CHAR8 **argv)
-{
-	EFI_STATUS ret = EFI_INVALID_PARAMETER;
-	UINTN payload_size, read_size, already_read, ckh_blks, data_size;
-	const UINTN MAX_DATA_SIZE = dl->max_size - offsetof(flash_buffer_t, ckh_data);
-	const UINTN MAX_BLKS = MAX_DATA_SIZE / fb->sph.blk_sz;
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	struct chunk_header *ckh;
-	void *read_ptr;
-
-	ckh = &fb->d.ckh;
-	payload_size = ckh->total_sz - sizeof(*ckh);
-	fb->sph.total_chunks = 2; /* skip and data chunks. */
-
-	for (ckh_blks = ckh->chunk_sz; ckh_blks; ckh_blks -= ckh->chunk_sz) {
-		ckh->chunk_sz = min(MAX_BLKS, ckh_blks);
-		data_size = (UINTN)ckh->chunk_sz * (UINTN)fb->sph.blk_sz;
-		ckh->total_sz = sizeof(*ckh) + data_size;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz + ckh->chunk_sz;
-
-		installer_flash_buffer(fb, ckh->total_sz + HEADER_SIZE, argc, argv);
-		if (!last_cmd_succeeded)
-			return EFI_INVALID_PARAMETER;
-
-		payload_size -= data_size;
-		if (!payload_size)
-			break;
-
-		/* Move the incomplete data from the end to the
-		   beginning of the buffer. */
-		read_ptr = fb->ckh_data;
-		read_size = min(payload_size, MAX_DATA_SIZE);
-		if (data_size < MAX_DATA_SIZE) {
-			already_read = MAX_DATA_SIZE - data_size;
-			ret = memcpy_s(read_ptr, MAX_DATA_SIZE, fb->d.data + ckh->total_sz, already_read);
-			if (EFI_ERROR(ret))
-				return ret;
-			read_size -= already_read;
-			read_ptr += already_read;
-		}
+	EFI_STATUS ret;
+	EFI_FILE *file;
+	UINTN i, total;
+	CHAR8 *data;
 
-		ret = read_file(file, read_size, read_ptr);
-		if (EFI_ERROR(ret))
-			return ret;
-		*remaining_data -= read_size;
+	for (i = 0, total = 0; i < num; i++)
+		total += size[i];
 
-		fb->skip_ckh.chunk_sz += ckh->chunk_sz;
+	data = AllocatePool(total);
+	if (!data) {
+		fastboot_fail("Failed to allocate %d bytes", total);
+		return;
 	}
 
-	if (payload_size)
-		return EFI_INVALID_PARAMETER;
-
-	return EFI_SUCCESS;
-}
-/*this function splits a huge sparse file and put together the two image*/
-static void installer_split_and_joint_flash(CHAR16 **filename,
-						UINTN *size, UINTN num, UINTN argc, CHAR8 **argv)
-{
-	EFI_STATUS ret;
-	flash_buffer_t *fb;
-	UINTN  read_flags = 0;
-	struct sparse_header sph;
-	struct chunk_header *ckh;
-	UINTN read_size, flash_size, already_read = 0, remaining_data = 0;
-	void *read_ptr;
-	INTN nb_chunks;
-	EFI_FILE *file[num];
-	UINT32 blk_count;
-
-	memset_s(file, sizeof(file), 0, sizeof(file));
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	const UINTN MAX_DATA_SIZE = dl->max_size - HEADER_SIZE;
-	for (UINTN i = 0; i < num; i++) {
-		remaining_data = remaining_data + size[i];
-		ret = uefi_open_file(file_io_interface, filename[i], &file[i]);
+	for (i = 0, total = 0; i < num; total += size[i], i++) {
+		ret = uefi_open_file(file_io_interface, filename[i], &file);
 		if (EFI_ERROR(ret)) {
 			inst_perror(ret, "Failed to open %s file", filename[i]);
-			return;
-		}
-	}
-
-	ret = read_file(file[0], sizeof(sph), &sph);
-	if (EFI_ERROR(ret))
-		return;
-	remaining_data -= sizeof(sph);
-	size[read_flags] -=  sizeof(sph);
-	if (!is_sparse_image((void *) &sph, sizeof(sph))) {
-		fastboot_fail("sparse file expected");
-		return;
-	}
-	fb = dl->data;
-	ret = memcpy_s(&fb->sph, sizeof(fb->sph), &sph, sizeof(sph));
-	if (EFI_ERROR(ret))
-		return;
-	/* Sparse skip chunk. */
-	fb->skip_ckh.chunk_type = CHUNK_TYPE_DONT_CARE;
-	fb->skip_ckh.total_sz = sizeof(fb->skip_ckh);
-	nb_chunks = sph.total_chunks;
-	read_size = MAX_DATA_SIZE;
-	read_ptr = fb->d.data;
-	blk_count = 0;
-	while (nb_chunks > 0 && remaining_data > 0) {
-		fb->sph.total_chunks = 1;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz = blk_count;
-		if (remaining_data < read_size)
-			read_size = remaining_data;
-		/* Read a new piece of the input sparse file. */
-		ret = read_file(file[read_flags], read_size, read_ptr);
-		if (EFI_ERROR(ret))
 			goto exit;
-		remaining_data -= read_size;
-		size[read_flags] -= read_size;
-		/* Process the loaded chunks to build the new header
-		   and the skip chunk. */
-		flash_size = HEADER_SIZE;
-		ckh = &fb->d.ckh;
-		while ((void *)ckh + sizeof(*ckh) <= read_ptr + read_size &&
-				(void *)ckh + ckh->total_sz <= read_ptr + read_size) {
-			if (nb_chunks == 0)
-				goto exit;
-			flash_size += ckh->total_sz;
-			fb->sph.total_blks += ckh->chunk_sz;
-			blk_count += ckh->chunk_sz;
-			fb->sph.total_chunks++;
-			nb_chunks--;
-			ckh = (void *)ckh + ckh->total_sz;
-		}
-		/* chunk is too big to fit in the download buffer. */
-		if (flash_size == HEADER_SIZE) {
-			if (ckh->chunk_type != CHUNK_TYPE_RAW ||
-					remaining_data < ckh->total_sz - MAX_DATA_SIZE) {
-				fastboot_fail("Corrupted sparse file");
-				goto exit;
-			}
-
-			blk_count += ckh->chunk_sz;
-			nb_chunks--;
-
-			ret = installer_flash_big_chunk_multiple(file, &read_flags,
-						size[read_flags], &remaining_data, fb, argc, argv);
-			if (EFI_ERROR(ret))
-				goto exit;
-
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-			continue;
 		}
 
-		installer_flash_buffer(dl->data, flash_size, argc, argv);
-		if (!last_cmd_succeeded)
+		ret = read_file(file, size[i], data + total);
+		uefi_call_wrapper(file->Close, 1, file);
+		if (EFI_ERROR(ret))
 			goto exit;
-		/* Move the incomplete chunk from the end to the
-		   beginning of the buffer. */
+	}
 
-		if (dl->data + flash_size < read_ptr + read_size) {
-			already_read = read_ptr + read_size - (void *)ckh;
-			ret = memcpy_s(fb->d.data, MAX_DATA_SIZE, ckh, already_read);
-			if (EFI_ERROR(ret))
-				goto exit;
-			read_size = MAX_DATA_SIZE - already_read;
-			read_ptr = fb->d.data + already_read;
+	installer_flash_buffer(data, total, 2, argv);
 
-		} else {
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-		}
-		if ((read_size > size[read_flags]) && (read_flags != (num - 1))) {
-			ret = read_file(file[read_flags], size[read_flags], read_ptr);
-			if (EFI_ERROR(ret))
-				goto exit;
-			ret = memcpy_s(fb->d.data+already_read, MAX_DATA_SIZE, read_ptr, size[read_flags]);
-			if (EFI_ERROR(ret))
-				goto exit;
-			read_size = read_size - size[read_flags];
-			remaining_data  -= size[read_flags];
-			read_ptr = fb->d.data+already_read+size[read_flags];
-			read_flags++;
-			}
-	}
 exit:
-	for (UINTN i = 0; i < num; i++)
-		uefi_call_wrapper(file[i]->Close, 1, file[i]);
+	FreePool(data);
 }
-/* This function splits a huge sparse file into smaller ones and flash
-   them. */
-static void installer_split_and_flash(CHAR16 *filename, UINTN size,
-				      UINTN argc, CHAR8 **argv)
+
+/* Flash the concatenation of the NUM files FILENAME into the ARGV[1]
+   partition.  The files are read piece by piece into the download
+   buffer and pushed to the flash stream which takes care of the
+   sparse format, so images of any size can be flashed.  */
+static void installer_stream_flash(CHAR16 **filename, UINTN *size,
+				   UINTN num, CHAR8 **argv)
 {
 	EFI_STATUS ret;
-	flash_buffer_t *fb;
-	struct sparse_header sph;
-	struct chunk_header *ckh;
-	UINTN read_size, flash_size, already_read, remaining_data = size;
-	void *read_ptr;
-	INTN nb_chunks;
 	EFI_FILE *file;
-	UINT32 blk_count;
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	const UINTN MAX_DATA_SIZE = dl->max_size - HEADER_SIZE;
+	CHAR16 *label;
+	UINTN i, remaining, read_size;
 
-	ret = uefi_open_file(file_io_interface, filename, &file);
-	if (EFI_ERROR(ret)) {
-		inst_perror(ret, "Failed to open %s file", filename);
+	if (!fastboot_flash_allowed(argv[1]))
 		return;
-	}
 
-	ret = read_file(file, sizeof(sph), &sph);
-	if (EFI_ERROR(ret))
-		return;
-	remaining_data -= sizeof(sph);
-
-	if (!is_sparse_image((void *) &sph, sizeof(sph))) {
-		fastboot_fail("sparse file expected");
+	label = stra_to_str(argv[1]);
+	if (!label) {
+		fastboot_fail("Failed to convert CHAR8 label to CHAR16");
 		return;
 	}
 
-	fb = dl->data;
-
-	/* New sparse header. */
-	ret = memcpy_s(&fb->sph, sizeof(fb->sph), &sph, sizeof(sph));
-	if (EFI_ERROR(ret))
-		return;
-
-	/* Sparse skip chunk. */
-	fb->skip_ckh.chunk_type = CHUNK_TYPE_DONT_CARE;
-	fb->skip_ckh.total_sz = sizeof(fb->skip_ckh);
-
-	nb_chunks = sph.total_chunks;
-	read_size = MAX_DATA_SIZE;
-	read_ptr = fb->d.data;
-	blk_count = 0;
-
-	while (nb_chunks > 0 && remaining_data > 0) {
-		fb->sph.total_chunks = 1;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz = blk_count;
+	ret = flash_stream_begin(label);
+	if (ret == EFI_UNSUPPORTED) {
+		installer_buffered_flash(filename, size, num, argv);
+		goto exit;
+	}
+	if (EFI_ERROR(ret)) {
+		inst_perror(ret, "Failed to flash %s", label);
+		goto exit;
+	}
 
-		if (remaining_data < read_size)
-			read_size = remaining_data;
+	info(L"Flashing %s ...", label);
 
-		/* Read a new piece of the input sparse file. */
-		ret = read_file(file, read_size, read_ptr);
-		if (EFI_ERROR(ret))
-			goto exit;
-		remaining_data -= read_size;
-
-		/* Process the loaded chunks to build the new header
-		   and the skip chunk. */
-		flash_size = HEADER_SIZE;
-		ckh = &fb->d.ckh;
-		while ((void *)ckh + sizeof(*ckh) <= read_ptr + read_size &&
-				(void *)ckh + ckh->total_sz <= read_ptr + read_size) {
-			if (nb_chunks == 0) {
-				fastboot_fail("Corrupted sparse file: too many chunks");
-				goto exit;
-			}
-			flash_size += ckh->total_sz;
-			fb->sph.total_blks += ckh->chunk_sz;
-			blk_count += ckh->chunk_sz;
-			fb->sph.total_chunks++;
-			nb_chunks--;
-			ckh = (void *)ckh + ckh->total_sz;
+	for (i = 0; i < num; i++) {
+		ret = uefi_open_file(file_io_interface, filename[i], &file);
+		if (EFI_ERROR(ret)) {
+			inst_perror(ret, "Failed to open %s file", filename[i]);
+			goto abort;
 		}
 
-		/* chunk is too big to fit in the download buffer. */
-		if (flash_size == HEADER_SIZE) {
-			if (ckh->chunk_type != CHUNK_TYPE_RAW ||
-					remaining_data < ckh->total_sz - MAX_DATA_SIZE) {
-				fastboot_fail("Corrupted sparse file");
-				goto exit;
-			}
-
-			blk_count += ckh->chunk_sz;
-			nb_chunks--;
-
-			ret = installer_flash_big_chunk(file, &remaining_data,
-					fb, argc, argv);
+		for (remaining = size[i]; remaining; remaining -= read_size) {
+			read_size = min(remaining, dl->max_size);
+			ret = read_file(file, read_size, dl->data);
 			if (EFI_ERROR(ret))
-				goto exit;
+				break;
 
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-			continue;
+			ret = flash_stream_write(dl->data, read_size);
+			if (EFI_ERROR(ret)) {
+				inst_perror(ret, "Failed to flash %s file", filename[i]);
+				break;
+			}
 		}
 
-		installer_flash_buffer(dl->data, flash_size, argc, argv);
-		if (!last_cmd_succeeded)
-			goto exit;
+		uefi_call_wrapper(file->Close, 1, file);
+		if (EFI_ERROR(ret))
+			goto abort;
+	}
 
-		/* Move the incomplete chunk from the end to the
-		   beginning of the buffer. */
-		if (dl->data + flash_size < read_ptr + read_size) {
-			already_read = read_ptr + read_size - (void *)ckh;
-			ret = memcpy_s(fb->d.data, MAX_DATA_SIZE, ckh, already_read);
-			if (EFI_ERROR(ret))
-				goto exit;
-			read_size = MAX_DATA_SIZE - already_read;
-			read_ptr = fb->d.data + already_read;
-		} else {
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-		}
+	ret = flash_stream_end();
+	if (EFI_ERROR(ret)) {
+		inst_perror(ret, "Flash failure");
+		goto exit;
 	}
 
+	gpt_sync();
+	info(L"Flash done.");
+	fastboot_okay("");
+	goto exit;
+
+abort:
+	flash_stream_abort();
 exit:
-	uefi_call_wrapper(file->Close, 1, file);
+	FreePool(label);
 }
 
 static void installer_flash_cmd(INTN argc, CHAR8 **argv)
@@ -645,7 +373,7 @@ static void installer_flash_cmd(INTN argc, CHAR8 **argv)
 			goto exit;
 		}
 
-		installer_split_and_joint_flash(numname, numsize, num, argc, argv);
+		installer_stream_flash(numname, numsize, num, argv);
 	} else {
 		/* The fastboot flash command does not want the file parameter. */
 		argc--;
@@ -687,7 +415,7 @@ static void installer_flash_cmd(INTN argc, CHAR8 **argv)
 		}
 
 		if (size > dl->max_size) {
-			installer_split_and_flash(filename, size, argc, argv);
+			installer_stream_flash(&filename, &size, 1, argv);
 			goto exit;
 		}
 
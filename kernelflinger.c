@@ -55,6 +55,7 @@
 #include "storage.h"
 #include "version.h"
 #include "timer.h"
+#include "trace.h"
 #ifdef HAL_AUTODETECT
 #include "blobstore.h"
 #endif
@@ -1241,7 +1242,9 @@ static EFI_STATUS load_image(VOID *bootimage, VOID *vendorbootimage, UINT8 boot_
 	}
 
 	/* install acpi tables before starting trusty */
+	TRACE_BEGIN("acpi_install");
 	ret = setup_acpi_table(bootimage, boot_target);
+	TRACE_END("acpi_install");
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"setup_acpi_table");
 		return ret;
@@ -1259,7 +1262,9 @@ static EFI_STATUS load_image(VOID *bootimage, VOID *vendorbootimage, UINT8 boot_
 #endif
 		}
 		debug(L"loading trusty");
+		TRACE_BEGIN("trusty_load");
 		ret = load_tos_image(&tosimage);
+		TRACE_END("trusty_load");
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Load tos image failed");
 			die();
@@ -1278,7 +1283,9 @@ static EFI_STATUS load_image(VOID *bootimage, VOID *vendorbootimage, UINT8 boot_
 		}
 
 		set_boottime_stamp(TM_LOAD_TOS_DONE);
+		TRACE_BEGIN("trusty_start");
 		ret = start_trusty(tosimage);
+		TRACE_END("trusty_start");
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Unable to start trusty; stop.");
 			die();
@@ -1574,7 +1581,9 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 		boot_target = FASTBOOT;
 	}
 
+	TRACE_BEGIN("slot_init");
 	ret = slot_init();
+	TRACE_END("slot_init");
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Slot management initialization failed");
 		return ret;
@@ -1730,8 +1739,10 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 
 	/* AVB check */
 	disable_slot_if_efi_loaded_slot_failed();
+	TRACE_BEGIN("avb_verify");
 	ret = avb_load_verify_boot_image(boot_target, target_path, &bootimage, oneshot, &boot_state, &vb_data);
 	avb_load_verify_vendor_boot_image(boot_target, &vendorbootimage);
+	TRACE_END("avb_verify");
 
 	set_boottime_stamp(TM_VERIFY_BOOT_DONE);
 
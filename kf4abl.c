@@ -48,6 +48,7 @@
 #include "android.h"
 #include "slot.h"
 #include "timer.h"
+#include "trace.h"
 #include "security.h"
 #include "security_interface.h"
 #ifdef RPMB_STORAGE
@@ -196,6 +197,10 @@ static EFI_STATUS process_bootimage(void *bootimage, UINTN imagesize)
 		NULL};
 	bool allow_verification_error = FALSE;
 	AvbSlotVerifyFlags flags;
+	const char *boot_suffix = "";
+	char boot_label[32];
+	uint64_t boot_size;
+	bool preloaded = false;
 
 #ifdef USE_TRUSTY
 	VOID *tosimage = NULL;
@@ -220,6 +225,20 @@ static EFI_STATUS process_bootimage(void *bootimage, UINTN imagesize)
 	flags = AVB_SLOT_VERIFY_FLAGS_NONE;
 	if (allow_verification_error) {
 		flags |= AVB_SLOT_VERIFY_FLAGS_ALLOW_VERIFICATION_ERROR;
+
+		/* Let AVB use the received image in place instead of
+		 * reading the boot partition again.  AVB then loads the
+		 * whole partition, so only an image padded to the
+		 * partition size, as signed images are, can stand for
+		 * it. */
+		if (use_slot() && slot_get_active())
+			boot_suffix = slot_get_active();
+		efi_snprintf((CHAR8 *)boot_label, sizeof(boot_label), (CHAR8 *)"boot%a",
+			     boot_suffix);
+		if (ops->get_size_of_partition(ops, boot_label, &boot_size) == AVB_IO_RESULT_OK &&
+		    imagesize >= boot_size)
+			preloaded = uefi_avb_register_preloaded_partition("boot", boot_suffix,
+									  bootimage, imagesize);
 	}
 
 #ifdef USE_SLOT
@@ -234,12 +253,14 @@ static EFI_STATUS process_bootimage(void *bootimage, UINTN imagesize)
 	}
 	slot_set_active_cached(slot_data->ab_suffix);
 #else
+	TRACE_BEGIN("avb_verify");
 	verify_result = avb_slot_verify(ops,
 					requested_partitions,
 					slot_suffix,
 					flags,
 					AVB_HASHTREE_ERROR_MODE_RESTART,
 					&slot_data);
+	TRACE_END("avb_verify");
 	ret = get_avb_result(slot_data,
 				allow_verification_error,
 				verify_result,
@@ -251,7 +272,9 @@ static EFI_STATUS process_bootimage(void *bootimage, UINTN imagesize)
 #endif
 	param = slot_data;
 
+	TRACE_BEGIN("acpi_install");
 	ret = android_install_acpi_table_avb(slot_data);
+	TRACE_END("acpi_install");
 	if (EFI_ERROR(ret)) goto fail;
 
 	set_boottime_stamp(TM_VERIFY_BOOT_DONE);
@@ -262,13 +285,17 @@ static EFI_STATUS process_bootimage(void *bootimage, UINTN imagesize)
 		goto fail;
 	}
 
+	TRACE_BEGIN("trusty_load");
 	ret = load_tos_image(&tosimage);
+	TRACE_END("trusty_load");
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Load tos image failed");
 		goto fail;
 	}
 	set_boottime_stamp(TM_LOAD_TOS_DONE);
+	TRACE_BEGIN("trusty_start");
 	ret = start_trusty(tosimage);
+	TRACE_END("trusty_start");
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Unable to start trusty: stop");
 		goto fail;
@@ -276,6 +303,8 @@ static EFI_STATUS process_bootimage(void *bootimage, UINTN imagesize)
 	set_boottime_stamp(TM_PROCRSS_TRUSTY_DONE);
 #endif //USE_TRUSTY
 fail:
+	if (preloaded)
+		uefi_avb_unregister_preloaded_partition("boot", boot_suffix);
 #else
 	//Fastboot stored in the SPI gets the capability to load an image
 	//(fastboot boot) using the RAMDISK and nothing from the eMMC
@@ -818,12 +847,14 @@ EFI_STATUS avb_boot_android(enum boot_target boot_target, CHAR8 *abl_cmd_line)
 		}
 	}
 #else
+	TRACE_BEGIN("avb_verify");
 	verify_result = avb_slot_verify(ops,
 					requested_partitions,
 					slot_suffix,
 					flags,
 					AVB_HASHTREE_ERROR_MODE_RESTART,
 					&slot_data);
+	TRACE_END("avb_verify");
 	ret = get_avb_result(slot_data,
 				allow_verification_error,
 				verify_result,
@@ -840,7 +871,9 @@ EFI_STATUS avb_boot_android(enum boot_target boot_target, CHAR8 *abl_cmd_line)
 		goto fail;
 	}
 
+	TRACE_BEGIN("acpi_install");
 	ret = android_install_acpi_table_avb(slot_data);
+	TRACE_END("acpi_install");
 	if (EFI_ERROR(ret)) goto fail;
 
 	ret = avb_vbmeta_image_verify(slot_data->vbmeta_images[0].vbmeta_data,
@@ -870,13 +903,17 @@ EFI_STATUS avb_boot_android(enum boot_target boot_target, CHAR8 *abl_cmd_line)
 #ifdef USE_TRUSTY
 	if (boot_target == NORMAL_BOOT) {
 		VOID *tosimage = NULL;
+		TRACE_BEGIN("trusty_load");
 		ret = load_tos_image(&tosimage);
+		TRACE_END("trusty_load");
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Load tos image failed");
 			goto fail;
 		}
 		set_boottime_stamp(TM_LOAD_TOS_DONE);
+		TRACE_BEGIN("trusty_start");
 		ret = start_trusty(tosimage);
+		TRACE_END("trusty_start");
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Unable to start trusty: stop");
 			goto fail;
@@ -954,7 +991,9 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 	rpmb_storage_init();
 #endif
 
+	TRACE_BEGIN("slot_init");
 	ret = slot_init();
+	TRACE_END("slot_init");
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Slot management initialization failed");
 		return ret;
@@ -4,6 +4,9 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE := libadb-$(TARGET_BUILD_VARIANT)
 LOCAL_CFLAGS := $(KERNELFLINGER_CFLAGS)
+ifneq ($(strip $(KERNELFLINGER_ADB_PART_READER_BUF_SIZE)),)
+    LOCAL_CFLAGS += -DPART_READER_BUF_SIZE=$(KERNELFLINGER_ADB_PART_READER_BUF_SIZE)
+endif
 LOCAL_STATIC_LIBRARIES := \
 	$(KERNELFLINGER_STATIC_LIBRARIES) \
 	libefiusb-$(TARGET_BUILD_VARIANT) \
@@ -26,6 +29,7 @@ LOCAL_SRC_FILES := \
 	ioport.c \
 	lspartition.c \
 	pci_class.c \
-	lspci.c
+	lspci.c \
+	lz4.c
 
 include $(BUILD_EFI_STATIC_LIBRARY)
@@ -42,6 +42,7 @@ struct asock {
 	adb_pkt_t msg;
 	adb_pkt_t wrt;
 	unsigned char data[ADB_MAX_PAYLOAD];
+	UINT32 queued;		/* Bytes of DATA waiting for asock_flush() */
 	service_t *service;
 	void *context;
 };
@@ -77,6 +78,7 @@ EFI_STATUS asock_open(UINT32 remote, service_t *service, char *arg)
 	s->remote = remote;
 	s->service = service;
 	s->context = NULL;
+	s->queued = 0;
 
 	ret = service->open(arg, &s->context);
 	if (EFI_ERROR(ret))
@@ -143,26 +145,52 @@ EFI_STATUS asock_read(asock_t s, unsigned char *data, UINT32 length)
 }
 
 /* Device to host */
-EFI_STATUS asock_write(asock_t s, unsigned char *data, UINT32 length)
+EFI_STATUS asock_queue(asock_t s, unsigned char *data, UINT32 length)
 {
 	EFI_STATUS ret;
 
-	if (!s || length > adb_max_payload)
+	if (!s || length > asock_queue_room(s))
 		return EFI_INVALID_PARAMETER;
 
 #ifdef CRASHMODE_USE_ADB
-	ret = memdump(s->data, sizeof(s->data), data, length);
+	ret = memdump(s->data + s->queued, sizeof(s->data) - s->queued, data, length);
 #elif
-	ret = memcpy_s(s->data, sizeof(s->data), data, length);
+	ret = memcpy_s(s->data + s->queued, sizeof(s->data) - s->queued, data, length);
 #endif
 
 	if (EFI_ERROR(ret))
 		return ret;
+	s->queued += length;
+	return EFI_SUCCESS;
+}
+
+UINT32 asock_queue_room(asock_t s)
+{
+	return s ? adb_max_payload - s->queued : 0;
+}
+
+EFI_STATUS asock_flush(asock_t s)
+{
+	if (!s)
+		return EFI_INVALID_PARAMETER;
+
 	s->wrt.data = s->data;
-	s->wrt.msg.data_length = length;
+	s->wrt.msg.data_length = s->queued;
+	s->queued = 0;
 	return adb_send_pkt(&s->wrt, A_WRTE, s->local, s->remote);
 }
 
+EFI_STATUS asock_write(asock_t s, unsigned char *data, UINT32 length)
+{
+	EFI_STATUS ret;
+
+	ret = asock_queue(s, data, length);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return asock_flush(s);
+}
+
 EFI_STATUS asock_send_okay(asock_t s)
 {
 	if (!s)
@@ -52,6 +52,14 @@ EFI_STATUS asock_read(asock_t s, unsigned char *data, UINT32 length);
 
 /* Device to host */
 EFI_STATUS asock_write(asock_t s, unsigned char *data, UINT32 length);
+
+/* The adb protocol allows only one WRTE packet waiting for the host
+   OKAY message per socket.  asock_queue() appends data to the socket
+   write buffer, asock_flush() sends all of it as one WRTE packet.
+   asock_write() flushes the data queued before it.  */
+EFI_STATUS asock_queue(asock_t s, unsigned char *data, UINT32 length);
+UINT32 asock_queue_room(asock_t s);
+EFI_STATUS asock_flush(asock_t s);
 EFI_STATUS asock_send_okay(asock_t s);
 EFI_STATUS asock_send_close(asock_t s);
 
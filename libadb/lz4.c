@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2024, Intel Corporation
+ * All rights reserved.
+ *
+ * Authors: Jeremy Compostella <jeremy.compostella@intel.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <lib.h>
+
+#include "lz4.h"
+
+/* LZ4 frame and block formats are described in
+   https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md and
+   https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md.  This
+   is a greedy single-pass compressor: it trades compression ratio for
+   speed, which is what matters to dump memory over USB.  It does not
+   make any dynamic memory allocation.  */
+
+#define LZ4_MAGIC		0x184D2204
+#define LZ4_FLG			0x60 /* Version 01, independent blocks */
+#define LZ4_BD			0x40 /* 64 KB maximum block size */
+#define LZ4_HC			0x82 /* (XXH32({ FLG, BD }, 0) >> 8) & 0xff */
+#define LZ4_UNCOMPRESSED_BLOCK	0x80000000
+
+#define MINMATCH		4
+#define LASTLITERALS		5  /* The last 5 bytes are always literals */
+#define MFLIMIT			12 /* No match can start in the last 12 bytes */
+#define ML_BITS			4
+#define ML_MASK			((1 << ML_BITS) - 1)
+#define RUN_MASK		ML_MASK
+
+#define HASH_LOG		12
+
+/* Positions are block offsets, LZ4_BLOCK_SIZE fits in 16 bits.  */
+static UINT16 hash_table[1 << HASH_LOG];
+
+static UINT32 read32(const UINT8 *p)
+{
+	return (UINT32)p[0] | (UINT32)p[1] << 8 |
+		(UINT32)p[2] << 16 | (UINT32)p[3] << 24;
+}
+
+static void write32(UINT8 *p, UINT32 v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static UINT32 hash(UINT32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static UINT8 *write_length(UINT8 *op, UINTN len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+
+	return op;
+}
+
+/* Worst case size of a sequence of LIT literals followed by a match
+ * of MLEN bytes.  */
+static UINTN sequence_max_size(UINTN lit, UINTN mlen)
+{
+	return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+static UINT8 *write_literals(UINT8 *op, UINT8 *token, const UINT8 *anchor, UINTN lit)
+{
+	if (lit >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = write_length(op, lit - RUN_MASK);
+	} else
+		*token = lit << ML_BITS;
+
+	memcpy(op, anchor, lit);
+	return op + lit;
+}
+
+/* Return the size of the compressed block or 0 if it does not fit in
+ * CAPACITY bytes.  */
+static UINTN compress_block(const UINT8 *src, UINTN len, UINT8 *dst, UINTN capacity)
+{
+	const UINT8 *ip = src, *anchor = src, *ref;
+	const UINT8 *end = src + len;
+	const UINT8 *mflimit = len > MFLIMIT ? end - MFLIMIT : src;
+	const UINT8 *matchlimit = end - LASTLITERALS;
+	UINT8 *op = dst, *oend = dst + capacity, *token;
+	UINTN lit, mlen;
+	UINT32 h;
+
+	memset(hash_table, 0, sizeof(hash_table));
+
+	while (ip < mflimit) {
+		h = hash(read32(ip));
+		ref = src + hash_table[h];
+		hash_table[h] = ip - src;
+		if (ref >= ip || read32(ref) != read32(ip)) {
+			ip++;
+			continue;
+		}
+
+		for (mlen = MINMATCH; ip + mlen < matchlimit; mlen++)
+			if (ip[mlen] != ref[mlen])
+				break;
+
+		lit = ip - anchor;
+		if (sequence_max_size(lit, mlen) > (UINTN)(oend - op))
+			return 0;
+
+		token = op++;
+		op = write_literals(op, token, anchor, lit);
+
+		*op++ = (ip - ref);
+		*op++ = (ip - ref) >> 8;
+
+		mlen -= MINMATCH;
+		if (mlen >= ML_MASK) {
+			*token |= ML_MASK;
+			op = write_length(op, mlen - ML_MASK);
+		} else
+			*token |= mlen;
+
+		ip += mlen + MINMATCH;
+		anchor = ip;
+	}
+
+	lit = end - anchor;
+	if (1 + lit / 255 + 1 + lit > (UINTN)(oend - op))
+		return 0;
+
+	token = op++;
+	op = write_literals(op, token, anchor, lit);
+
+	return op - dst;
+}
+
+UINTN lz4_frame_header(UINT8 *buf)
+{
+	write32(buf, LZ4_MAGIC);
+	buf[4] = LZ4_FLG;
+	buf[5] = LZ4_BD;
+	buf[6] = LZ4_HC;
+
+	return LZ4_FRAME_HEADER_SIZE;
+}
+
+UINTN lz4_frame_block(const UINT8 *src, UINTN len, UINT8 *dst)
+{
+	UINTN size;
+
+	size = compress_block(src, len, dst + LZ4_BLOCK_HEADER_SIZE, len - 1);
+	if (size) {
+		write32(dst, size);
+		return LZ4_BLOCK_HEADER_SIZE + size;
+	}
+
+	write32(dst, len | LZ4_UNCOMPRESSED_BLOCK);
+	memcpy(dst + LZ4_BLOCK_HEADER_SIZE, src, len);
+	return LZ4_BLOCK_HEADER_SIZE + len;
+}
+
+UINTN lz4_frame_end(UINT8 *buf)
+{
+	write32(buf, 0);
+	return LZ4_END_MARK_SIZE;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2024, Intel Corporation
+ * All rights reserved.
+ *
+ * Authors: Jeremy Compostella <jeremy.compostella@intel.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include <efi.h>
+
+/* Maximum size of an LZ4 frame block as announced in the frame
+ * descriptor built by lz4_frame_header().  */
+#define LZ4_BLOCK_SIZE		(64 * 1024)
+
+#define LZ4_FRAME_HEADER_SIZE	7
+#define LZ4_BLOCK_HEADER_SIZE	4
+#define LZ4_END_MARK_SIZE	4
+
+/* Worst case size of a frame block, header included.  Blocks which do
+ * not compress are stored uncompressed.  */
+#define LZ4_BLOCK_MAX_SIZE	(LZ4_BLOCK_HEADER_SIZE + LZ4_BLOCK_SIZE)
+
+/* Write the LZ4 frame header in BUF and return its size.  The frame
+ * uses independent blocks of at most LZ4_BLOCK_SIZE bytes, without
+ * content size nor checksums.  */
+UINTN lz4_frame_header(UINT8 *buf);
+
+/* Compress the LEN bytes of SRC (LEN <= LZ4_BLOCK_SIZE) as one frame
+ * block in DST which must be at least LZ4_BLOCK_MAX_SIZE bytes long.
+ * Return the size of the block, header included.  */
+UINTN lz4_frame_block(const UINT8 *src, UINTN len, UINT8 *dst);
+
+/* Write the LZ4 frame end mark in BUF and return its size.  */
+UINTN lz4_frame_end(UINT8 *buf);
+
+#endif	/* _LZ4_H_ */
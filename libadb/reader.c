@@ -37,8 +37,11 @@
 #ifndef __LP64__
 #include "pae.h"
 #endif
+#include "lz4.h"
 #include "reader.h"
 #include "sparse_format.h"
+#include "storage_io.h"
+#include "trace.h"
 
 /* Memory dump shared functions.  These functions do not make any
    dynamic memory allocation to avoid RAM corruption during the
@@ -125,16 +128,21 @@ static EFI_STATUS memory_open(reader_ctx_t *ctx, memory_t *mem,
 	if (EFI_ERROR(ret))
 		return ret;
 
-	ret = init(ctx, mem);
-	if (EFI_ERROR(ret))
-		goto err;
-
+	/* INIT may have to look at the memory content */
 #ifndef __LP64__
 	ret = pae_init(mem->memmap, mem->nr_descr, mem->descr_sz);
 	if (EFI_ERROR(ret))
 		goto err;
 #endif
 
+	ret = init(ctx, mem);
+	if (EFI_ERROR(ret)) {
+#ifndef __LP64__
+		pae_exit();
+#endif
+		goto err;
+	}
+
 	return EFI_SUCCESS;
 
 err:
@@ -142,20 +150,27 @@ err:
 	return EFI_ERROR(ret) ? ret : EFI_INVALID_PARAMETER;
 }
 
+/* Map at most LEN bytes of memory from ADDR.  On return, LEN is the
+   size of the mapped window.  */
+static EFI_STATUS memory_map(EFI_PHYSICAL_ADDRESS addr, unsigned char **buf, UINT64 *len)
+{
+#ifdef __LP64__
+	(void)len;
+	*buf = (unsigned char *)addr;
+	return EFI_SUCCESS;
+#else
+	return pae_map(addr, buf, len);
+#endif
+}
+
 static EFI_STATUS memory_read_current(memory_t *mem, unsigned char **buf, UINT64 *len)
 {
-#ifndef __LP64__
 	EFI_STATUS ret;
-#endif
 
 	*len = min(*len, mem->cur_end - mem->cur);
-#ifdef __LP64__
-	*buf = (unsigned char *)mem->cur;
-#else
-	ret = pae_map(mem->cur, buf, len);
+	ret = memory_map(mem->cur, buf, len);
 	if (EFI_ERROR(ret))
 		return ret;
-#endif
 	mem->cur += *len;
 
 	return EFI_SUCCESS;
@@ -173,14 +188,30 @@ static void memory_close(reader_ctx_t *ctx)
 #define SIZEOF_TOTALSZ		sizeof(((chunk_header_t *)0)->total_sz)
 #define MAX_CHUNK_SIZE		(((UINT64)1 << (SIZEOF_TOTALSZ * 8)) - EFI_PAGE_SIZE)
 
+/* The "ram-fill" reader exports the runs of uniform pages of at least
+   RAM_FILL_MIN_SIZE bytes as FILL chunks.  Smaller runs are not worth
+   the extra chunk.  */
+#define RAM_FILL_MIN_SIZE	(1024 * 1024)
+
+/* Each memory region uses at most a few chunks.  FILL chunks are only
+   created as long as this leaves room for the remaining regions.  */
+#define RAM_MAX_CHUNK_NB	(16 * MAX_MEMORY_REGION_NB)
+#define RAM_FILL_MAX_CHUNK_NB	(RAM_MAX_CHUNK_NB - 4 * MAX_MEMORY_REGION_NB)
+
+struct ram_chunk {
+	struct chunk_header header;
+	UINT32 fill;		/* CHUNK_TYPE_FILL data */
+};
+
 static struct ram_priv {
 	memory_t m;
+	BOOLEAN fill;
 
 	/* Sparse format */
 	UINTN chunk_nb;
 	UINTN cur_chunk;
 	struct sparse_header sheader;
-	struct chunk_header chunks[MAX_MEMORY_REGION_NB];
+	struct ram_chunk chunks[RAM_MAX_CHUNK_NB];
 } ram_priv = {
 	.sheader = {
 		.magic = SPARSE_HEADER_MAGIC,
@@ -212,12 +243,12 @@ static EFI_STATUS ram_add_chunk(reader_ctx_t *ctx, struct ram_priv *priv, UINT16
 		}
 	}
 
-	if (priv->chunk_nb == MAX_MEMORY_REGION_NB) {
+	if (priv->chunk_nb == RAM_MAX_CHUNK_NB) {
 		error(L"Failed to allocate a new chunk");
 		return EFI_OUT_OF_RESOURCES;
 	}
 
-	cur = &priv->chunks[priv->chunk_nb++];
+	cur = &priv->chunks[priv->chunk_nb++].header;
 
 	cur->chunk_type = type;
 	cur->chunk_sz = size / EFI_PAGE_SIZE;
@@ -227,6 +258,10 @@ static EFI_STATUS ram_add_chunk(reader_ctx_t *ctx, struct ram_priv *priv, UINT16
 		cur->total_sz += size;
 		ctx->len += size;
 	}
+	if (type == CHUNK_TYPE_FILL) {
+		cur->total_sz += sizeof(((struct ram_chunk *)0)->fill);
+		ctx->len += sizeof(((struct ram_chunk *)0)->fill);
+	}
 
 	priv->sheader.total_chunks++;
 	priv->sheader.total_blks += cur->chunk_sz;
@@ -234,11 +269,119 @@ static EFI_STATUS ram_add_chunk(reader_ctx_t *ctx, struct ram_priv *priv, UINT16
 	return EFI_SUCCESS;
 }
 
+static EFI_STATUS ram_add_fill_chunk(reader_ctx_t *ctx, struct ram_priv *priv,
+				     UINT64 size, UINT32 fill)
+{
+	EFI_STATUS ret;
+
+	ret = ram_add_chunk(ctx, priv, CHUNK_TYPE_FILL, size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	priv->chunks[priv->chunk_nb - 1].fill = fill;
+	return EFI_SUCCESS;
+}
+
+static BOOLEAN is_uniform_page(unsigned char *page, UINT32 *fill)
+{
+	UINT32 *p = (UINT32 *)page;
+	UINTN i;
+
+	for (i = 1; i < EFI_PAGE_SIZE / sizeof(*p); i++)
+		if (p[i] != p[0])
+			return FALSE;
+
+	*fill = p[0];
+	return TRUE;
+}
+
+/* Add the uniform run [RUN, END) as a FILL chunk, preceded by the
+   pending RAW run [*RAW, RUN).  */
+static EFI_STATUS ram_add_run(reader_ctx_t *ctx, struct ram_priv *priv,
+			      EFI_PHYSICAL_ADDRESS *raw, EFI_PHYSICAL_ADDRESS run,
+			      EFI_PHYSICAL_ADDRESS end, UINT32 fill)
+{
+	EFI_STATUS ret;
+
+	if (run > *raw) {
+		ret = ram_add_chunk(ctx, priv, CHUNK_TYPE_RAW, run - *raw);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	ret = ram_add_fill_chunk(ctx, priv, end - run, fill);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	*raw = end;
+	return EFI_SUCCESS;
+}
+
+static BOOLEAN ram_can_add_run(struct ram_priv *priv, UINT64 size)
+{
+	return size >= RAM_FILL_MIN_SIZE &&
+		priv->chunk_nb + 2 <= RAM_FILL_MAX_CHUNK_NB;
+}
+
+/* Add the chunks describing the LENGTH bytes of conventional memory
+   at START.  Runs of uniform pages are exported as FILL chunks.  */
+static EFI_STATUS ram_add_region(reader_ctx_t *ctx, struct ram_priv *priv,
+				 EFI_PHYSICAL_ADDRESS start, UINT64 length)
+{
+	EFI_STATUS ret;
+	EFI_PHYSICAL_ADDRESS cur, page, end = start + length;
+	EFI_PHYSICAL_ADDRESS raw = start;	/* Start of the pending RAW run */
+	EFI_PHYSICAL_ADDRESS run = start;	/* Start of the uniform run */
+	UINT32 run_fill = 0, fill = 0;
+	BOOLEAN uniform;
+	unsigned char *buf;
+	UINT64 len, i;
+
+	if (!priv->fill)
+		return ram_add_chunk(ctx, priv, CHUNK_TYPE_RAW, length);
+
+	for (cur = start; cur < end; cur += len) {
+		len = end - cur;
+		ret = memory_map(cur, &buf, &len);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		for (i = 0; i < len; i += EFI_PAGE_SIZE) {
+			page = cur + i;
+			uniform = is_uniform_page(buf + i, &fill);
+			if (uniform && (run == page || fill == run_fill)) {
+				run_fill = fill;
+				continue;
+			}
+
+			if (ram_can_add_run(priv, page - run)) {
+				ret = ram_add_run(ctx, priv, &raw, run, page, run_fill);
+				if (EFI_ERROR(ret))
+					return ret;
+			}
+
+			/* This page may start a new uniform run */
+			run = uniform ? page : page + EFI_PAGE_SIZE;
+			run_fill = fill;
+		}
+	}
+
+	if (ram_can_add_run(priv, end - run)) {
+		ret = ram_add_run(ctx, priv, &raw, run, end, run_fill);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	if (raw == end)
+		return EFI_SUCCESS;
+
+	return ram_add_chunk(ctx, priv, CHUNK_TYPE_RAW, end - raw);
+}
+
 static EFI_STATUS ram_build_chunks(reader_ctx_t *ctx, void *priv_p)
 {
 	struct ram_priv *priv = priv_p;
 	EFI_STATUS ret = EFI_SUCCESS;
-	UINT16 type;
 	UINTN i;
 	EFI_MEMORY_DESCRIPTOR *entry;
 	UINT64 entry_len, length;
@@ -287,8 +430,10 @@ static EFI_STATUS ram_build_chunks(reader_ctx_t *ctx, void *priv_p)
 		if (priv->m.end && priv->m.end < entry_end)
 			length -= entry_end - priv->m.end;
 
-		type = entry->Type == EfiConventionalMemory ? CHUNK_TYPE_RAW : CHUNK_TYPE_DONT_CARE;
-		ret = ram_add_chunk(ctx, priv, type, length);
+		if (entry->Type == EfiConventionalMemory)
+			ret = ram_add_region(ctx, priv, max(entry->PhysicalStart, priv->m.start), length);
+		else
+			ret = ram_add_chunk(ctx, priv, CHUNK_TYPE_DONT_CARE, length);
 		if (EFI_ERROR(ret))
 			goto err;
 
@@ -322,13 +467,26 @@ err:
 
 static EFI_STATUS ram_open(reader_ctx_t *ctx, UINTN argc, char **argv)
 {
+	if (ram_priv.m.is_in_used)
+		return EFI_ALREADY_STARTED;
+
+	ram_priv.fill = FALSE;
+	return memory_open(ctx, &ram_priv.m, ram_build_chunks, argc, argv);
+}
+
+static EFI_STATUS ram_fill_open(reader_ctx_t *ctx, UINTN argc, char **argv)
+{
+	if (ram_priv.m.is_in_used)
+		return EFI_ALREADY_STARTED;
+
+	ram_priv.fill = TRUE;
 	return memory_open(ctx, &ram_priv.m, ram_build_chunks, argc, argv);
 }
 
 static EFI_STATUS ram_read(reader_ctx_t *ctx, unsigned char **buf, UINT64 *len)
 {
 	struct ram_priv *priv;
-	struct chunk_header *chunk;
+	struct ram_chunk *chunk;
 
 	priv = (struct ram_priv *)ctx->private;
 
@@ -350,14 +508,16 @@ static EFI_STATUS ram_read(reader_ctx_t *ctx, unsigned char **buf, UINT64 *len)
 			return EFI_INVALID_PARAMETER;
 		}
 
-		if (priv->cur_chunk >= (MAX_MEMORY_REGION_NB-1))
+		if (priv->cur_chunk >= RAM_MAX_CHUNK_NB)
 			return EFI_INVALID_PARAMETER;
 
 		chunk = &priv->chunks[priv->cur_chunk++];
 		*buf = (unsigned char *)chunk;
-		*len = sizeof(*chunk);
-		priv->m.cur_end = priv->m.cur + chunk->chunk_sz * EFI_PAGE_SIZE;
-		if (chunk->chunk_type != CHUNK_TYPE_RAW)
+		*len = sizeof(chunk->header);
+		if (chunk->header.chunk_type == CHUNK_TYPE_FILL)
+			*len += sizeof(chunk->fill);
+		priv->m.cur_end = priv->m.cur + chunk->header.chunk_sz * EFI_PAGE_SIZE;
+		if (chunk->header.chunk_type != CHUNK_TYPE_RAW)
 			priv->m.cur = priv->m.cur_end;
 		return EFI_SUCCESS;
 	}
@@ -600,18 +760,168 @@ static EFI_STATUS vmcore_read(reader_ctx_t *ctx, unsigned char **buf, UINT64 *le
 	return memory_read_current(&priv->m, buf, len);
 }
 
+/* LZ4 compressed VMCore reader */
+static struct vmcore_lz4_priv {
+	reader_ctx_t vmcore;	/* Uncompressed vmcore stream */
+	BOOLEAN done;
+
+	UINT8 in[LZ4_BLOCK_SIZE];
+	UINT8 out[LZ4_FRAME_HEADER_SIZE + LZ4_BLOCK_MAX_SIZE + LZ4_END_MARK_SIZE];
+	UINTN out_cur;
+	UINTN out_len;
+} vmcore_lz4_priv;
+
+static EFI_STATUS vmcore_lz4_open(reader_ctx_t *ctx, UINTN argc, char **argv)
+{
+	struct vmcore_lz4_priv *priv = &vmcore_lz4_priv;
+	EFI_STATUS ret;
+	UINT64 blocks;
+
+	ret = vmcore_open(&priv->vmcore, argc, argv);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	/* The compressed size is only known once the whole vmcore
+	   has been read.  CTX->LEN is the worst case size,
+	   vmcore_lz4_read() reports the actual end of the stream.  */
+	blocks = (priv->vmcore.len + LZ4_BLOCK_SIZE - 1) / LZ4_BLOCK_SIZE;
+	ctx->private = priv;
+	ctx->cur = 0;
+	ctx->len = LZ4_FRAME_HEADER_SIZE + blocks * LZ4_BLOCK_MAX_SIZE +
+		LZ4_END_MARK_SIZE;
+
+	priv->done = FALSE;
+	priv->out_cur = priv->out_len = 0;
+
+	return EFI_SUCCESS;
+}
+
+/* Read the next LZ4_BLOCK_SIZE bytes of the vmcore in PRIV->IN.  */
+static EFI_STATUS vmcore_lz4_load(struct vmcore_lz4_priv *priv, UINTN *size)
+{
+	reader_ctx_t *vmcore = &priv->vmcore;
+	EFI_STATUS ret;
+	unsigned char *buf;
+	UINT64 len;
+
+	for (*size = 0; *size < sizeof(priv->in) && vmcore->cur < vmcore->len; *size += len) {
+		len = min(sizeof(priv->in) - *size, vmcore->len - vmcore->cur);
+		ret = vmcore_read(vmcore, &buf, &len);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		memcpy(priv->in + *size, buf, len);
+		vmcore->cur += len;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS vmcore_lz4_compress(reader_ctx_t *ctx, struct vmcore_lz4_priv *priv)
+{
+	EFI_STATUS ret;
+	UINTN size;
+
+	priv->out_cur = priv->out_len = 0;
+	if (priv->done)
+		return EFI_SUCCESS;
+
+	if (ctx->cur == 0)
+		priv->out_len += lz4_frame_header(priv->out);
+
+	ret = vmcore_lz4_load(priv, &size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (size)
+		priv->out_len += lz4_frame_block(priv->in, size, priv->out + priv->out_len);
+
+	if (priv->vmcore.cur == priv->vmcore.len) {
+		priv->out_len += lz4_frame_end(priv->out + priv->out_len);
+		priv->done = TRUE;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS vmcore_lz4_read(reader_ctx_t *ctx, unsigned char **buf, UINT64 *len)
+{
+	struct vmcore_lz4_priv *priv = ctx->private;
+	EFI_STATUS ret;
+
+	if (priv->out_cur == priv->out_len) {
+		ret = vmcore_lz4_compress(ctx, priv);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	/* A zero length read reports the end of the stream */
+	*len = min(*len, priv->out_len - priv->out_cur);
+	*buf = priv->out + priv->out_cur;
+	priv->out_cur += *len;
+
+	return EFI_SUCCESS;
+}
+
+static void vmcore_lz4_close(reader_ctx_t *ctx)
+{
+	memory_close(&((struct vmcore_lz4_priv *)ctx->private)->vmcore);
+}
+
 /* Partition reader */
+#ifndef PART_READER_BUF_SIZE
 #define PART_READER_BUF_SIZE (10 * 1024 * 1024)
+#endif
+
+/* While one buffer is sent, the other ones are being read.  */
+#define PART_READER_BUF_NB 2
 
 struct part_priv {
 	struct gpt_partition_interface gparti;
-	BOOLEAN need_more_data;
-	unsigned char buf[PART_READER_BUF_SIZE];
+	struct storage_io *io;
+	unsigned char *buf[PART_READER_BUF_NB];
+	UINTN buf_len[PART_READER_BUF_NB];
+	UINTN cur_buf;		/* Buffer being sent */
+	BOOLEAN ready;		/* CUR_BUF read is complete */
 	UINTN buf_cur;
-	UINTN buf_len;
 	UINT64 offset;
+	UINT64 next;		/* Next partition offset to read */
 };
 
+static void part_free(struct part_priv *priv)
+{
+	UINTN i;
+
+	/* In-flight requests must complete before their buffer is freed */
+	if (priv->io)
+		storage_io_close(priv->io);
+
+	for (i = 0; i < PART_READER_BUF_NB; i++)
+		if (priv->buf[i])
+			FreePool(priv->buf[i]);
+
+	FreePool(priv);
+}
+
+static EFI_STATUS part_queue_read(reader_ctx_t *ctx, struct part_priv *priv, UINTN i)
+{
+	EFI_STATUS ret;
+
+	priv->buf_len[i] = min((UINT64)PART_READER_BUF_SIZE, ctx->len - priv->next);
+	if (priv->buf_len[i] == 0)
+		return EFI_SUCCESS;
+
+	ret = storage_io_read(priv->io, priv->offset + priv->next,
+			      priv->buf_len[i], priv->buf[i]);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to read partition");
+		return ret;
+	}
+
+	priv->next += priv->buf_len[i];
+	return EFI_SUCCESS;
+}
+
 static EFI_STATUS _part_open(reader_ctx_t *ctx, UINTN argc, char **argv, logical_unit_t log_unit)
 {
 	EFI_STATUS ret = EFI_SUCCESS;
@@ -619,11 +929,12 @@ static EFI_STATUS _part_open(reader_ctx_t *ctx, UINTN argc, char **argv, logical
 	struct part_priv *priv;
 	CHAR16 *partname;
 	UINT64 length;
+	UINTN i;
 
 	if (argc < 1 || argc > 3)
 		return EFI_INVALID_PARAMETER;
 
-	priv = ctx->private = AllocatePool(sizeof(*priv));
+	priv = ctx->private = AllocateZeroPool(sizeof(*priv));
 	if (!priv)
 		return EFI_OUT_OF_RESOURCES;
 
@@ -661,14 +972,29 @@ static EFI_STATUS _part_open(reader_ctx_t *ctx, UINTN argc, char **argv, logical
 			goto err;
 	}
 
-	priv->buf_cur = 0;
-	priv->buf_len = 0;
-	priv->need_more_data = TRUE;
+	for (i = 0; i < PART_READER_BUF_NB; i++) {
+		priv->buf[i] = AllocatePool(PART_READER_BUF_SIZE);
+		if (!priv->buf[i]) {
+			ret = EFI_OUT_OF_RESOURCES;
+			goto err;
+		}
+	}
+
+	ret = storage_io_open(gparti, &priv->io);
+	if (EFI_ERROR(ret))
+		goto err;
+
+	priv->next = ctx->cur;
+	for (i = 0; i < PART_READER_BUF_NB; i++) {
+		ret = part_queue_read(ctx, priv, i);
+		if (EFI_ERROR(ret))
+			goto err;
+	}
 
 	return EFI_SUCCESS;
 
 err:
-	FreePool(priv);
+	part_free(priv);
 	return EFI_ERROR(ret) ? ret : EFI_INVALID_PARAMETER;
 }
 
@@ -687,29 +1013,39 @@ static EFI_STATUS part_read(reader_ctx_t *ctx, unsigned char **buf, UINT64 *len)
 	EFI_STATUS ret;
 	struct part_priv *priv = ctx->private;
 
-	if (priv->need_more_data) {
-		priv->buf_len = min(sizeof(priv->buf), ctx->len - ctx->cur);
-		ret = uefi_call_wrapper(priv->gparti.dio->ReadDisk, 5, priv->gparti.dio,
-					priv->gparti.bio->Media->MediaId,
-					priv->offset + ctx->cur, priv->buf_len, priv->buf);
+	/* The current buffer has been sent, re-use it to read ahead */
+	if (priv->ready && priv->buf_cur == priv->buf_len[priv->cur_buf]) {
+		ret = part_queue_read(ctx, priv, priv->cur_buf);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		priv->cur_buf = (priv->cur_buf + 1) % PART_READER_BUF_NB;
+		priv->ready = FALSE;
+	}
+
+	if (!priv->ready) {
+		ret = storage_io_wait(priv->io);
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Failed to read partition");
 			return ret;
 		}
 
-		priv->need_more_data = FALSE;
+		priv->ready = TRUE;
 		priv->buf_cur = 0;
 	}
 
-	*len = min(*len, priv->buf_len - priv->buf_cur);
-	*buf = priv->buf + priv->buf_cur;
+	*len = min(*len, priv->buf_len[priv->cur_buf] - priv->buf_cur);
+	*buf = priv->buf[priv->cur_buf] + priv->buf_cur;
 	priv->buf_cur += *len;
-	if (priv->buf_cur == priv->buf_len)
-		priv->need_more_data = TRUE;
 
 	return EFI_SUCCESS;
 }
 
+static void part_close(reader_ctx_t *ctx)
+{
+	part_free(ctx->private);
+}
+
 /* ACPI table reader */
 static EFI_STATUS acpi_open(reader_ctx_t *ctx, UINTN argc, char **argv)
 {
@@ -998,6 +1334,26 @@ static EFI_STATUS bert_region_read(reader_ctx_t *ctx, unsigned char **buf, UINT6
 }
 
 /* Interface */
+/* Boot trace reader */
+static EFI_STATUS trace_open(reader_ctx_t *ctx, UINTN argc,
+			     __attribute__((__unused__)) char **argv)
+{
+	EFI_STATUS ret;
+	UINTN len;
+
+	if (argc != 0)
+		return EFI_INVALID_PARAMETER;
+
+	ret = trace_to_json((CHAR8 **)&ctx->private, &len);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to export the trace buffer");
+		return ret;
+	}
+
+	ctx->len = len;
+	return EFI_SUCCESS;
+}
+
 static EFI_STATUS read_from_private(reader_ctx_t *ctx, unsigned char **buf,
 				    __attribute__((__unused__)) UINT64 *len)
 {
@@ -1017,17 +1373,20 @@ struct reader {
 	void (*close)(reader_ctx_t *ctx);
 } READERS[] = {
 	{ "ram",		ram_open,			ram_read,		memory_close },
+	{ "ram-fill",		ram_fill_open,			ram_read,		memory_close },
 	{ "vmcore",		vmcore_open,			vmcore_read,		memory_close },
+	{ "vmcore-lz4",		vmcore_lz4_open,		vmcore_lz4_read,	vmcore_lz4_close },
 	{ "acpi",		acpi_open,			read_from_private,	NULL },
-	{ "part",		part_open,			part_read,		free_private },
-	{ "factory-part",	factory_part_open,		part_read,		free_private },
+	{ "part",		part_open,			part_read,		part_close },
+	{ "factory-part",	factory_part_open,		part_read,		part_close },
 	{ "efivar",		efivar_open,			read_from_private,	free_private },
 	{ "mbr",		mbr_open,			read_from_private,	free_private },
 	{ "gpt-header",		gpt_header_open,		read_from_private,	free_private },
 	{ "gpt-parts",		gpt_parts_open,			read_from_private,	free_private },
 	{ "gpt-factory-header",	gpt_factory_header_open,	read_from_private,	free_private },
 	{ "gpt-factory-parts",	gpt_factory_parts_open,		read_from_private,	free_private },
-	{ "bert-region",	bert_region_open,		bert_region_read,	NULL }
+	{ "bert-region",	bert_region_open,		bert_region_read,	NULL },
+	{ "trace",		trace_open,			read_from_private,	free_private }
 };
 
 #define MAX_ARGS		8
@@ -141,45 +141,61 @@ static EFI_STATUS send_done(asock_t s, sync_ctx_t *ctx)
 
 #define DATA_PROGRESS_THRESHOLD (5 * 1024 * 1024)
 
+/* Each OKAY message from the host costs a round trip.  Fill every WRTE
+   packet up to the negotiated adb payload size with as many DATA
+   messages, and their headers, as it can hold.  */
 static EFI_STATUS send_more_data(asock_t s, sync_ctx_t *ctx)
 {
 	EFI_STATUS ret;
-	UINT32 sent;
+	UINT32 room, sent;
 	sync_msg_t msg;
 
-	/* Need to load more data. */
-	if (ctx->need_more_data) {
-		ctx->buf_len = SYNC_DATA_MAX;
+	for (;;) {
+		room = asock_queue_room(s);
 
-		ret = reader_read(&ctx->reader_ctx, &ctx->buf, &ctx->buf_len);
-		if (EFI_ERROR(ret))
-			return ret;
-		if (ctx->buf_len == 0) /* No more data to send. */
-			return send_done(s, ctx);
+		/* Need to load more data. */
+		if (ctx->need_more_data) {
+			if (room < sizeof(msg.data))
+				break;
 
-		msg.data.id = ID_DATA;
-		msg.data.size = ctx->buf_len;
-		ctx->buf_cur = 0;
-		ctx->need_more_data = FALSE;
+			ctx->buf_len = SYNC_DATA_MAX;
 
-		return asock_write(s, (unsigned char *)&msg, sizeof(msg.data));
-	}
+			ret = reader_read(&ctx->reader_ctx, &ctx->buf, &ctx->buf_len);
+			if (EFI_ERROR(ret))
+				return ret;
+			if (ctx->buf_len == 0) /* No more data to send. */
+				return send_done(s, ctx);
 
-	sent = min((UINTN)adb_max_payload, ctx->buf_len - ctx->buf_cur);
-	ret = asock_write(s, ctx->buf + ctx->buf_cur, sent);
-	if (EFI_ERROR(ret))
-		return ret;
+			msg.data.id = ID_DATA;
+			msg.data.size = ctx->buf_len;
+			ctx->buf_cur = 0;
+			ctx->need_more_data = FALSE;
 
-	ctx->buf_cur = ctx->buf_cur + sent;
-	if (ctx->buf_cur == ctx->buf_len)
-		ctx->need_more_data = TRUE;
+			ret = asock_queue(s, (unsigned char *)&msg, sizeof(msg.data));
+			if (EFI_ERROR(ret))
+				return ret;
+			continue;
+		}
 
-	ctx->sent += sent;
-	if (ctx->sent >= DATA_PROGRESS_THRESHOLD &&
-	    ctx->sent % DATA_PROGRESS_THRESHOLD < sent)
-		debug(L"%d MB have been sent", ctx->sent / 1024 / 1024);
+		if (room == 0)
+			break;
 
-	return ret;
+		sent = min((UINT64)room, ctx->buf_len - ctx->buf_cur);
+		ret = asock_queue(s, ctx->buf + ctx->buf_cur, sent);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		ctx->buf_cur = ctx->buf_cur + sent;
+		if (ctx->buf_cur == ctx->buf_len)
+			ctx->need_more_data = TRUE;
+
+		ctx->sent += sent;
+		if (ctx->sent >= DATA_PROGRESS_THRESHOLD &&
+		    ctx->sent % DATA_PROGRESS_THRESHOLD < sent)
+			debug(L"%d MB have been sent", ctx->sent / 1024 / 1024);
+	}
+
+	return asock_flush(s);
 }
 
 static EFI_STATUS sync_service_okay(asock_t s)
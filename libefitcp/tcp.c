@@ -35,6 +35,7 @@
 #include <vars.h>
 #include <efitcp.h>
 #include <smbios.h>
+#include <timer.h>
 
 #include "tcp.h"
 
@@ -49,17 +50,20 @@ static EFI_TCP4 *tcp_listener;
 static EFI_TCP4_LISTEN_TOKEN accept_token;
 static EFI_TCP4_CLOSE_TOKEN close_token;
 
-/* RX data structures  */
+/* RX data structures.  A single receive token is posted, right after
+   the data already received in the caller buffer.  The TCP stack
+   completes it with whatever it has buffered, often one segment, so
+   the data always lands where it belongs.  A second token would have
+   to start at a fixed offset past the first one and a short
+   completion of the first one would leave a hole.  Meanwhile, the TCP
+   receive buffer keeps the window open.  */
 #define MAX_TOKEN 16
-#define RX_FRAG_SIZE 2048  /* Fragment size greater or equal to TCP
-			      MSS  */
 typedef struct token {
 	EFI_TCP4_IO_TOKEN token;
 	UINT32 requested;
 } token_t;
-static token_t rx_token[MAX_TOKEN];
-static EFI_TCP4_RECEIVE_DATA rx_data[MAX_TOKEN];
-static CHAR8 rx_frag_buf[MAX_TOKEN][RX_FRAG_SIZE];
+static token_t rx_token;
+static EFI_TCP4_RECEIVE_DATA rx_data;
 
 /* TX data structures  */
 static UINTN next_tx_token;
@@ -74,29 +78,33 @@ static start_callback_t start_callback;
 static data_callback_t rx_callback;
 static data_callback_t tx_callback;
 
+/* RECEIVED is the number of bytes at the beginning of BUF.  */
 static struct rx {
 	char *buf;
 	UINT32 size;
-	UINT32 requested;
 	UINT32 received;
 	BOOLEAN receiving;
+	UINT64 start;
 } rx;
 
-static EFI_STATUS request_data(token_t *token, UINT32 max_size)
+/* Receive statistics  */
+static UINT64 rx_bytes, rx_ticks;
+
+/* Post the receive token for the rest of the caller buffer.  */
+static EFI_STATUS request_data(void)
 {
 	EFI_STATUS ret;
-	UINTN size = min(max_size, (UINT32)RX_FRAG_SIZE);
-	EFI_TCP4_RECEIVE_DATA *data = token->token.Packet.RxData;
-
-	data->DataLength = size;
-	data->FragmentTable[0].FragmentLength = size;
+	UINT32 size = rx.size - rx.received;
 
-	token->requested = size;
-	rx.requested += size;
+	rx_data.DataLength = size;
+	rx_data.FragmentTable[0].FragmentLength = size;
+	rx_data.FragmentTable[0].FragmentBuffer = rx.buf + rx.received;
+	rx_token.requested = size;
 
 	ret = uefi_call_wrapper(tcp_connection->Receive, 2,
-				tcp_connection, &token->token);
+				tcp_connection, &rx_token.token);
 	if (EFI_ERROR(ret)) {
+		rx_token.requested = 0;
 		rx.receiving = FALSE;
 		ret = uefi_call_wrapper(tcp_connection->Close, 2,
 					tcp_connection, &close_token);
@@ -107,6 +115,12 @@ static EFI_STATUS request_data(token_t *token, UINT32 max_size)
 	return ret;
 }
 
+void tcp_get_rx_stats(UINT64 *bytes, UINT64 *ticks)
+{
+	*bytes = rx_bytes;
+	*ticks = rx_ticks;
+}
+
 /* Event handlers */
 static void EFIAPI data_sent(__attribute__((__unused__)) EFI_EVENT evt,
 			     void *ctx)
@@ -155,24 +169,18 @@ static void EFIAPI data_received(__attribute__((__unused__)) EFI_EVENT evt, void
 		return;
 	}
 
-	ret = memcpy_s(rx.buf + rx.received, rx.size,
-				   data->FragmentTable[0].FragmentBuffer,
-				   data->FragmentTable[0].FragmentLength);
-	if (EFI_ERROR(ret)) {
-		rx.receiving = FALSE;
-		return;
-	}
-
-	rx.received += data->FragmentTable[0].FragmentLength;
-	rx.requested -= token->requested;
-
-	if (rx.requested < rx.size - rx.received)
-		request_data(token, rx.size - rx.received - rx.requested);
+	rx.received += data->DataLength;
+	token->requested = 0;
 
 	if (rx.received == rx.size) {
 		rx.receiving = FALSE;
+		rx_bytes += rx.received;
+		rx_ticks += rdtsc() - rx.start;
 		rx_callback(rx.buf, rx.received);
+		return;
 	}
+
+	request_data();
 }
 
 static void EFIAPI connection_accepted(__attribute__((__unused__)) EFI_EVENT evt,
@@ -199,6 +207,9 @@ static void EFIAPI connection_accepted(__attribute__((__unused__)) EFI_EVENT evt
 		return;
 	}
 
+	/* The token of a previous connection is not in flight anymore.  */
+	rx_token.requested = 0;
+
 	start_callback();
 }
 
@@ -228,12 +239,11 @@ static void init_rx_tx_structures()
 {
 	UINTN i;
 
-	for (i = 0; i < MAX_TOKEN; i++) {
-		rx_data[i].UrgentFlag = FALSE;
-		rx_data[i].FragmentCount = 1;
-		rx_data[i].FragmentTable[0].FragmentBuffer = rx_frag_buf[i];
-		rx_token[i].token.Packet.RxData = &rx_data[i];
+	rx_data.UrgentFlag = FALSE;
+	rx_data.FragmentCount = 1;
+	rx_token.token.Packet.RxData = &rx_data;
 
+	for (i = 0; i < MAX_TOKEN; i++) {
 		tx_data[i].Push = TRUE;
 		tx_data[i].Urgent = FALSE;
 		tx_data[i].FragmentCount = 1;
@@ -244,7 +254,7 @@ static void init_rx_tx_structures()
 static EFI_STATUS create_events()
 {
 	EFI_STATUS ret;
-	UINTN i = 0, j = 0, k;
+	UINTN i = 0, k;
 
 	ret = uefi_call_wrapper(BS->CreateEvent, 5,
 				EVT_NOTIFY_SIGNAL,
@@ -281,17 +291,15 @@ static EFI_STATUS create_events()
 		}
 	}
 
-	for (j = 0; j < MAX_TOKEN; j++) {
-		ret = uefi_call_wrapper(BS->CreateEvent, 5,
-					EVT_NOTIFY_SIGNAL,
-					TPL_CALLBACK,
-					data_received,
-					&rx_token[j],
-					&rx_token[j].token.CompletionToken.Event);
-		if (EFI_ERROR(ret)) {
-			efi_perror(ret, L"Failed to create TCP Receive event");
-			goto transmit;
-		}
+	ret = uefi_call_wrapper(BS->CreateEvent, 5,
+				EVT_NOTIFY_SIGNAL,
+				TPL_CALLBACK,
+				data_received,
+				&rx_token,
+				&rx_token.token.CompletionToken.Event);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to create TCP Receive event");
+		goto transmit;
 	}
 
 	events_created = TRUE;
@@ -307,9 +315,6 @@ transmit:
 	for (k = 0; k < i; k++)
 		uefi_call_wrapper(BS->CloseEvent, 1,
 				  tx_token[k].token.CompletionToken.Event);
-	for (k = 0; k < j; k++)
-		uefi_call_wrapper(BS->CloseEvent, 1,
-				  rx_token[k].token.CompletionToken.Event);
 	return ret;
 }
 
@@ -335,12 +340,10 @@ void close_events()
 			efi_perror(ret, L"Failed to close TCP Transmit %d event", i);
 	}
 
-	for (i = 0; i < MAX_TOKEN; i++) {
-		ret = uefi_call_wrapper(BS->CloseEvent, 1,
-					rx_token[i].token.CompletionToken.Event);
-		if (EFI_ERROR(ret))
-			efi_perror(ret, L"Failed to close TCP Receive %d event", i);
-	}
+	ret = uefi_call_wrapper(BS->CloseEvent, 1,
+				rx_token.token.CompletionToken.Event);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to close TCP Receive event");
 
 	events_created = FALSE;
 }
@@ -515,26 +518,21 @@ EFI_STATUS tcp_write(void *buf, UINT32 size)
 EFI_STATUS tcp_read(void *buf, UINT32 size)
 {
 	EFI_STATUS ret;
-	UINTN i;
 
 	if (rx.receiving)
 		return EFI_NOT_READY;
 
 	rx.buf = buf;
 	rx.size = size;
-	rx.received = rx.requested = 0;
+	rx.received = 0;
 	rx.receiving = TRUE;
+	rx.start = rdtsc();
 
-	for (i = 0; i < MAX_TOKEN && size; i++) {
-		ret = request_data(&rx_token[i], size);
-		if (EFI_ERROR(ret)) {
-			rx.receiving = FALSE;
-			return ret;
-		}
-		size -= rx_token[i].requested;
-	}
+	ret = request_data();
+	if (EFI_ERROR(ret))
+		rx.receiving = FALSE;
 
-	return EFI_SUCCESS;
+	return ret;
 }
 
 EFI_STATUS tcp_stop(void)
@@ -4,6 +4,9 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE := libefiusb-$(TARGET_BUILD_VARIANT)
 LOCAL_CFLAGS := $(KERNELFLINGER_CFLAGS)
+ifneq ($(strip $(KERNELFLINGER_USB_RX_CHUNK)),)
+    LOCAL_CFLAGS += -DRX_CHUNK=$(KERNELFLINGER_USB_RX_CHUNK)
+endif
 LOCAL_STATIC_LIBRARIES := \
 	$(KERNELFLINGER_STATIC_LIBRARIES) \
 	libtransport-$(TARGET_BUILD_VARIANT) \
@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <uefi_utils.h>
 #include <vars.h>
+#include <timer.h>
 
 #include "protocol.h"
 #include "usb.h"
@@ -56,6 +57,15 @@
 #define PRODUCT_ID		0x09EF
 #define BCD_DEVICE		0x0100
 
+/* Large usb_read() buffers are received as a chain of requests of at
+   most RX_CHUNK bytes.  The next request is queued as soon as the
+   previous one completes, from the completion handler, so the
+   controller keeps streaming while the upper layer is only notified
+   once for the whole buffer.  */
+#ifndef RX_CHUNK
+#define RX_CHUNK		(8 * 1024 * 1024)
+#endif
+
 static data_callback_t		rx_callback  = NULL;
 static data_callback_t		tx_callback  = NULL;
 static start_callback_t		start_callback = NULL;
@@ -67,6 +77,15 @@ static USB_DEVICE_ENDPOINT_OBJ	gEndpointObjs[ENDPOINT_COUNT];
 EFI_GUID gEfiUsbDeviceModeProtocolGuid = EFI_USB_DEVICE_MODE_PROTOCOL_GUID;
 static EFI_USB_DEVICE_MODE_PROTOCOL *usb_device = NULL;
 
+static struct {
+	CHAR8 *buf;
+	UINT32 size;
+	UINT32 received;
+	UINT32 queued;
+	UINT64 start;
+} rx;
+static UINT64 rx_completions, rx_bytes, rx_ticks;
+
 /* String descriptor table indexes */
 typedef enum {
 	STR_TBL_LANG,
@@ -178,20 +197,17 @@ EFI_STATUS usb_write(void *buf, UINT32 size)
 	return ret;
 }
 
-EFI_STATUS usb_read(void *buf, UINT32 size)
+static EFI_STATUS queue_rx_request(void)
 {
 	EFI_STATUS ret;
 	USB_DEVICE_IO_REQ ioReq;
 
-	/* WA: usb device stack doesn't accept rx buffer not multiple of MaxPacketSize */
-	unsigned max_pkt_size = config_descriptor.ep_out.MaxPacketSize;
-
-	size = ALIGN(size, max_pkt_size);
+	rx.queued = min(rx.size - rx.received, (UINT32)RX_CHUNK);
 
 	ioReq.EndpointInfo.EndpointDesc = &config_descriptor.ep_out;
 	ioReq.EndpointInfo.EndpointCompDesc = NULL;
-	ioReq.IoInfo.Buffer = buf;
-	ioReq.IoInfo.Length = size;
+	ioReq.IoInfo.Buffer = rx.buf + rx.received;
+	ioReq.IoInfo.Length = rx.queued;
 
 	/* queue the  receive request */
 	ret = uefi_call_wrapper(usb_device->EpRxData, 2, usb_device, &ioReq);
@@ -201,6 +217,48 @@ EFI_STATUS usb_read(void *buf, UINT32 size)
 	return ret;
 }
 
+EFI_STATUS usb_read(void *buf, UINT32 size)
+{
+	/* WA: usb device stack doesn't accept rx buffer not multiple of MaxPacketSize */
+	unsigned max_pkt_size = config_descriptor.ep_out.MaxPacketSize;
+
+	rx.buf = buf;
+	rx.size = ALIGN(size, max_pkt_size);
+	rx.received = 0;
+	rx.start = rdtsc();
+
+	return queue_rx_request();
+}
+
+/* Account a completed Rx request and chain the next one.  Return TRUE
+   when the usb_read() buffer is complete, that is when it is full or
+   when the host ended the transfer with a short packet.  */
+static BOOLEAN rx_request_done(UINT32 len)
+{
+	EFI_STATUS ret;
+
+	rx_completions++;
+	rx.received += len;
+	if (len < rx.queued || rx.received >= rx.size)
+		goto done;
+
+	ret = queue_rx_request();
+	if (!EFI_ERROR(ret))
+		return FALSE;
+
+done:
+	rx_bytes += rx.received;
+	rx_ticks += rdtsc() - rx.start;
+	return TRUE;
+}
+
+void usb_get_rx_stats(UINT64 *completions, UINT64 *bytes, UINT64 *ticks)
+{
+	*completions = rx_completions;
+	*bytes = rx_bytes;
+	*ticks = rx_ticks;
+}
+
 static EFIAPI EFI_STATUS setup_handler(__attribute__((__unused__)) EFI_USB_DEVICE_REQUEST *CtrlRequest,
 				       __attribute__((__unused__)) USB_DEVICE_IO_INFO *IoInfo)
 {
@@ -235,8 +293,10 @@ EFIAPI EFI_STATUS data_handler(EFI_USB_DEVICE_XFER_INFO *XferInfo)
 
 	/* if we are receiving a command or data, call the processing routine */
 	if (XferInfo->EndpointDir == USB_ENDPOINT_DIR_OUT) {
+		if (!rx_request_done(XferInfo->Length))
+			return EFI_SUCCESS;
 		if (rx_callback)
-			rx_callback(XferInfo->Buffer, XferInfo->Length);
+			rx_callback(rx.buf, rx.received);
 	} else
 		if (tx_callback)
 			tx_callback(XferInfo->Buffer, XferInfo->Length);
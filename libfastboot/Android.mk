@@ -5,6 +5,10 @@ SHARED_CFLAGS := \
 	$(KERNELFLINGER_CFLAGS) \
 	-DTARGET_BOOTLOADER_BOARD_NAME=\"$(TARGET_BOOTLOADER_BOARD_NAME)\"
 
+ifneq ($(strip $(KERNELFLINGER_FLASH_FLUSH_THRESHOLD)),)
+    SHARED_CFLAGS += -DFLASH_FLUSH_THRESHOLD=$(KERNELFLINGER_FLASH_FLUSH_THRESHOLD)
+endif
+
 SHARED_C_INCLUDES := $(LOCAL_PATH)/../include \
                      $(KERNELFLINGER_LOCAL_PATH)/libkernelflinger/fatfs/source \
                      $(KERNELFLINGER_LOCAL_PATH)/avb
@@ -39,6 +39,8 @@
 #include <ui.h>
 #include <em.h>
 #include <transport.h>
+#include <tcp.h>
+#include <usb.h>
 #include <slot.h>
 #include <storage.h>
 
@@ -110,6 +112,30 @@ static struct download_buffer dl;
 static const UINTN MIN_DLSIZE = 8 * 1024 * 1024;
 static const UINTN MAX_DLSIZE = 256 * 1024 * 1024;
 
+/* Streamed download: once a partition has been armed with "oem
+   stream-flash", the download is received in a ring of STREAM_SLOTS
+   buffers and each buffer is flashed while the next one is being
+   received.  The writes of a buffer are only queued, a buffer is
+   received into again once they have completed.  The download size
+   is then only limited by the protocol.  */
+#define STREAM_SLOTS 4
+static const UINTN STREAM_SLOT_SIZE = 4 * 1024 * 1024;
+static const UINTN STREAM_MAX_DLSIZE = 0xFFFFF000;
+static struct stream {
+	CHAR16 *label;
+	CHAR8 *slot[STREAM_SLOTS];
+	UINT32 len[STREAM_SLOTS];
+	UINTN size;
+	volatile UINTN filled;
+	volatile UINTN consumed;
+	volatile UINTN synced;
+	volatile BOOLEAN reading;
+	BOOLEAN active;
+	BOOLEAN pending;
+	EFI_STATUS status;
+} stream;
+static unsigned received_len;
+
 #ifndef FASTBOOT_FOR_NON_ANDROID
 static const char *flash_locked_whitelist[] = {
 	NULL
@@ -618,6 +644,122 @@ static const char *get_erase_block_size_var()
 	return erase_block_size;
 }
 
+static const char *get_max_download_size_var()
+{
+	static char download_max_str[30];
+	int len;
+
+	len = efi_snprintf((CHAR8 *)download_max_str, sizeof(download_max_str),
+			   (CHAR8 *)"0x%lX",
+			   stream.label ? STREAM_MAX_DLSIZE : dl.max_size);
+	if (len < 0 || len >= (int)sizeof(download_max_str))
+		return NULL;
+
+	return download_max_str;
+}
+
+static const char *get_flash_flush_count_var()
+{
+	static char flush_count[30];
+	UINT64 count, time_ms;
+	int len;
+
+	flash_get_flush_stats(&count, &time_ms);
+	len = efi_snprintf((CHAR8 *)flush_count, sizeof(flush_count),
+			   (CHAR8 *)"%ld", count);
+	if (len < 0 || len >= (int)sizeof(flush_count))
+		return NULL;
+
+	return flush_count;
+}
+
+static const char *get_flash_flush_time_var()
+{
+	static char flush_time[30];
+	UINT64 count, time_ms;
+	int len;
+
+	flash_get_flush_stats(&count, &time_ms);
+	len = efi_snprintf((CHAR8 *)flush_time, sizeof(flush_time),
+			   (CHAR8 *)"%ld", time_ms);
+	if (len < 0 || len >= (int)sizeof(flush_time))
+		return NULL;
+
+	return flush_time;
+}
+
+static const char *get_log_dropped_var()
+{
+	static char log_dropped[30];
+	int len;
+
+	len = efi_snprintf((CHAR8 *)log_dropped, sizeof(log_dropped),
+			   (CHAR8 *)"%ld", log_get_dropped());
+	if (len < 0 || len >= (int)sizeof(log_dropped))
+		return NULL;
+
+	return log_dropped;
+}
+
+static const char *get_tcp_rx_throughput_var()
+{
+	static char tcp_rx_throughput[30];
+	UINT64 bytes, ticks, throughput = 0;
+	UINT32 tsc_mhz;
+	int len;
+
+	tcp_get_rx_stats(&bytes, &ticks);
+	tsc_mhz = get_tsc_mhz();
+	if (tsc_mhz == 0)
+		tsc_mhz = get_cpu_freq();
+	if (tsc_mhz && ticks / tsc_mhz)
+		throughput = bytes * 1000000 / 1024 / (ticks / tsc_mhz);
+
+	len = efi_snprintf((CHAR8 *)tcp_rx_throughput, sizeof(tcp_rx_throughput),
+			   (CHAR8 *)"%ld", throughput);
+	if (len < 0 || len >= (int)sizeof(tcp_rx_throughput))
+		return NULL;
+
+	return tcp_rx_throughput;
+}
+
+static const char *get_usb_rx_completions_var()
+{
+	static char usb_rx_completions[30];
+	UINT64 completions, bytes, ticks;
+	int len;
+
+	usb_get_rx_stats(&completions, &bytes, &ticks);
+	len = efi_snprintf((CHAR8 *)usb_rx_completions, sizeof(usb_rx_completions),
+			   (CHAR8 *)"%ld", completions);
+	if (len < 0 || len >= (int)sizeof(usb_rx_completions))
+		return NULL;
+
+	return usb_rx_completions;
+}
+
+static const char *get_usb_rx_throughput_var()
+{
+	static char usb_rx_throughput[30];
+	UINT64 completions, bytes, ticks, throughput = 0;
+	UINT32 tsc_mhz;
+	int len;
+
+	usb_get_rx_stats(&completions, &bytes, &ticks);
+	tsc_mhz = get_tsc_mhz();
+	if (tsc_mhz == 0)
+		tsc_mhz = get_cpu_freq();
+	if (tsc_mhz && ticks / tsc_mhz)
+		throughput = bytes / (ticks / tsc_mhz);
+
+	len = efi_snprintf((CHAR8 *)usb_rx_throughput, sizeof(usb_rx_throughput),
+			   (CHAR8 *)"%ld", throughput);
+	if (len < 0 || len >= (int)sizeof(usb_rx_throughput))
+		return NULL;
+
+	return usb_rx_throughput;
+}
+
 static const char *get_logical_block_size_var()
 {
 	static char logical_block_size[MAX_VARIABLE_LENGTH];
@@ -810,24 +952,55 @@ EFI_STATUS refresh_partition_var(void)
 	return publish_partsize();
 }
 
+/* Apply the flash policy of the current device state to LABEL.  */
+BOOLEAN fastboot_flash_allowed(CHAR8 *label)
+{
+	CHAR16 *label16;
+	BOOLEAN allowed;
+
+#ifndef FASTBOOT_FOR_NON_ANDROID
+	if (get_current_state() == LOCKED &&
+	    !is_in_white_list(label, flash_locked_whitelist)) {
+		error(L"Flash %a is prohibited in %a state.", label,
+		      get_current_state_string());
+		fastboot_fail("Prohibited command in %a state.", get_current_state_string());
+		return FALSE;
+	}
+#endif
+	label16 = stra_to_str(label);
+	if (!label16) {
+		error(L"Failed to get label %a", label);
+		fastboot_fail("Allocation error");
+		return FALSE;
+	}
+
+	allowed = can_erase_or_flash_partition(label16);
+	FreePool(label16);
+	if (!allowed)
+		fastboot_fail("Currently virtual a/b ota is in progress...");
+
+	return allowed;
+}
+
 static void cmd_flash(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
 	CHAR16 *label;
+	const CHAR16 *full_label;
 
 	if (argc != 2) {
 		fastboot_fail("Invalid parameter");
 		return;
 	}
-#ifndef FASTBOOT_FOR_NON_ANDROID
-	if (get_current_state() == LOCKED &&
-	    !is_in_white_list(argv[1], flash_locked_whitelist)) {
-		error(L"Flash %a is prohibited in %a state.", argv[1],
-		      get_current_state_string());
-		fastboot_fail("Prohibited command in %a state.", get_current_state_string());
+
+	if (!fastboot_flash_allowed(argv[1])) {
+		if (stream.pending) {
+			stream.pending = FALSE;
+			flash_stream_abort();
+		}
 		return;
 	}
-#endif
+
 	label = stra_to_str((CHAR8*)argv[1]);
 	if (!label) {
 		error(L"Failed to get label %a", argv[1]);
@@ -835,16 +1008,22 @@ static void cmd_flash(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	if (!can_erase_or_flash_partition(label)) {
-		fastboot_fail("Currently virtual a/b ota is in progress...");
-		FreePool(label);
-		return;
-	}
-
 	info(L"Flashing %s ...", label);
-	debug(L"dl.data = %x, dl.size = %u", dl.data, dl.size);
-
-	ret = flash(dl.data, dl.size, label);
+	if (stream.pending) {
+		stream.pending = FALSE;
+		full_label = slot_label(label);
+		if (!full_label || StrCmp(full_label, flash_stream_label())) {
+			fastboot_fail("Streamed data was meant for %s",
+				      flash_stream_label());
+			flash_stream_abort();
+			FreePool(label);
+			return;
+		}
+		ret = flash_stream_end();
+	} else {
+		debug(L"dl.data = %x, dl.size = %u", dl.data, dl.size);
+		ret = flash(dl.data, dl.size, label);
+	}
 	FreePool(label);
 	if (EFI_ERROR(ret)) {
 		fastboot_fail("Flash failure: %r", ret);
@@ -1132,10 +1311,180 @@ static void fastboot_read_command(void)
 	transport_read(command_buffer, command_buffer_size);
 }
 
+static void stream_free(void)
+{
+	UINTN i;
+
+	if (stream.active || stream.pending)
+		flash_stream_abort();
+
+	for (i = 0; i < STREAM_SLOTS; i++)
+		if (stream.slot[i]) {
+			FreePool(stream.slot[i]);
+			stream.slot[i] = NULL;
+		}
+
+	if (stream.label) {
+		FreePool(stream.label);
+		stream.label = NULL;
+	}
+
+	stream.active = stream.pending = FALSE;
+}
+
+EFI_STATUS fastboot_stream_flash(CHAR8 *label)
+{
+	UINTN i;
+
+	stream_free();
+	if (!label)
+		return EFI_SUCCESS;
+
+	stream.label = stra_to_str(label);
+	if (!stream.label)
+		return EFI_OUT_OF_RESOURCES;
+
+	if (!can_erase_or_flash_partition(stream.label)) {
+		stream_free();
+		return EFI_ACCESS_DENIED;
+	}
+
+	if (!flash_stream_supported(stream.label)) {
+		error(L"%s cannot be flashed by stream", stream.label);
+		stream_free();
+		return EFI_UNSUPPORTED;
+	}
+
+	for (i = 0; i < STREAM_SLOTS; i++) {
+		stream.slot[i] = AllocatePool(STREAM_SLOT_SIZE);
+		if (!stream.slot[i]) {
+			error(L"Failed to allocate the stream buffers");
+			stream_free();
+			return EFI_OUT_OF_RESOURCES;
+		}
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS stream_start(UINTN size)
+{
+	EFI_STATUS ret;
+
+	ret = flash_stream_begin(stream.label);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	stream.size = size;
+	stream.filled = stream.consumed = stream.synced = 0;
+	stream.reading = FALSE;
+	stream.pending = FALSE;
+	stream.status = EFI_SUCCESS;
+	stream.active = TRUE;
+
+	return EFI_SUCCESS;
+}
+
+/* Queue a transport read into the next free slot, if any.  */
+static EFI_STATUS stream_read_next(void)
+{
+	EFI_STATUS ret;
+	UINTN slot;
+
+	if (stream.reading || received_len >= stream.size ||
+	    stream.filled - stream.synced == STREAM_SLOTS)
+		return EFI_SUCCESS;
+
+	slot = stream.filled % STREAM_SLOTS;
+	stream.reading = TRUE;
+	ret = transport_read(stream.slot[slot],
+			     min(stream.size - received_len, STREAM_SLOT_SIZE));
+	if (EFI_ERROR(ret))
+		stream.reading = FALSE;
+
+	return ret;
+}
+
+/* Called by the transport layer: the data is only accounted here,
+   it is flashed by fastboot_process_stream() from the main loop
+   which also reports the transport errors.  */
+static void stream_received(unsigned len)
+{
+	len = min(len, (unsigned)(stream.size - received_len));
+	stream.len[stream.filled % STREAM_SLOTS] = len;
+	stream.filled++;
+	stream.reading = FALSE;
+	received_len += len;
+	printProgress((received_len / MiB), (stream.size / MiB));
+
+	stream_read_next();
+}
+
+/* Wait for the queued writes of the flashed slots once all the slots
+   are in use, so that the next read can start.  */
+static void stream_reclaim(void)
+{
+	EFI_STATUS ret;
+
+	if (stream.filled - stream.synced != STREAM_SLOTS ||
+	    stream.synced == stream.consumed)
+		return;
+
+	ret = flash_stream_sync();
+	if (EFI_ERROR(ret) && !EFI_ERROR(stream.status))
+		stream.status = ret;
+	stream.synced = stream.consumed;
+}
+
+static void fastboot_process_stream(void)
+{
+	EFI_STATUS ret;
+	UINTN slot;
+
+	if (!stream.active || fastboot_state != STATE_DOWNLOAD)
+		return;
+
+	stream_reclaim();
+	ret = stream_read_next();
+	while (!EFI_ERROR(ret) && stream.consumed != stream.filled) {
+		slot = stream.consumed % STREAM_SLOTS;
+		if (!EFI_ERROR(stream.status))
+			stream.status = flash_stream_write(stream.slot[slot],
+							   stream.len[slot]);
+		stream.consumed++;
+		stream_reclaim();
+		ret = stream_read_next();
+	}
+
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to receive %d bytes",
+			   stream.size - received_len);
+		stream.active = FALSE;
+		flash_stream_abort();
+		fastboot_fail("Transport receive failed");
+		return;
+	}
+
+	if (received_len < stream.size || stream.consumed != stream.filled)
+		return;
+
+	stream.active = FALSE;
+	fastboot_state = STATE_COMPLETE;
+	if (EFI_ERROR(stream.status)) {
+		flash_stream_abort();
+		fastboot_fail("Flash failure: %r", stream.status);
+		return;
+	}
+
+	stream.pending = TRUE;
+	fastboot_okay("");
+}
+
 static void cmd_download(INTN argc, CHAR8 **argv)
 {
 	static CHAR8 response[MAGIC_LENGTH];
 	EFI_STATUS ret;
+	UINTN size;
 	int len;
 	char *endptr;
 
@@ -1144,20 +1493,31 @@ static void cmd_download(INTN argc, CHAR8 **argv)
 		return;
 	}
 
-	dl.size = strtoul((const char *)argv[1], &endptr, 16);
-	if (dl.size == 0 || *endptr != '\0') {
+	size = strtoul((const char *)argv[1], &endptr, 16);
+	if (size == 0 || *endptr != '\0') {
 		fastboot_fail("Failed to parse the download size");
 		return;
 	}
 
-	if (dl.size > dl.max_size) {
-		fastboot_fail("data too large");
-		return;
+	if (stream.label) {
+		ret = stream_start(size);
+		if (EFI_ERROR(ret)) {
+			fastboot_fail("Failed to stream into %s, %r",
+				      stream.label, ret);
+			return;
+		}
+		dl.size = 0;
+	} else {
+		if (size > dl.max_size) {
+			fastboot_fail("data too large");
+			return;
+		}
+		dl.size = size;
 	}
-	ui_print(L"Receiving 0x%llx bytes ...", dl.size);
+	ui_print(L"Receiving 0x%llx bytes ...", size);
 
 	len = efi_snprintf(response, sizeof(response), (CHAR8 *)"DATA%08x",
-			   dl.size);
+			   size);
 	if (len < 0) {
 		error(L"Failed to format DATA response");
 		fastboot_fail("Failed to format DATA response");
@@ -1176,9 +1536,13 @@ static void worker_download(void)
 {
 	EFI_STATUS ret;
 
-	ret = transport_read(dl.data, dl.size);
+	if (stream.active)
+		ret = stream_read_next();
+	else
+		ret = transport_read(dl.data, dl.size);
 	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to receive %d bytes", dl.size);
+		efi_perror(ret, L"Failed to receive %d bytes",
+			   stream.active ? stream.size : dl.size);
 		fastboot_fail("Transport receive failed");
 		return;
 	}
@@ -1207,7 +1571,6 @@ static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
 	}
 }
 
-static unsigned received_len;
 static unsigned last_received_len;
 #define DATA_PROGRESS_THRESHOLD (5 * 1024 * 1024)
 static void fastboot_run_command()
@@ -1240,6 +1603,10 @@ static void fastboot_process_rx(void *buf, unsigned len)
 
 	switch (fastboot_state) {
 	case STATE_DOWNLOAD:
+		if (stream.active) {
+			stream_received(len);
+			break;
+		}
 		received_len += len;
 		printProgress((received_len / MiB), (dl.size / MiB));
 		if (received_len < dl.size) {
@@ -1319,7 +1686,6 @@ static EFI_STATUS fastboot_init()
 {
 	EFI_STATUS ret;
 	UINTN i;
-	char download_max_str[30];
 	static char default_command_buffer[MAGIC_LENGTH];
 
 	ret = fastboot_set_command_buffer(default_command_buffer,
@@ -1379,14 +1745,7 @@ static EFI_STATUS fastboot_init()
 	if (EFI_ERROR(ret))
 		goto error;
 
-	if (efi_snprintf((CHAR8 *)download_max_str, sizeof(download_max_str),
-			 (CHAR8 *)"0x%lX", dl.max_size) < 0) {
-		error(L"Failed to set download_max_str string");
-		ret = EFI_INVALID_PARAMETER;
-		goto error;
-	}
-
-	ret = fastboot_publish("max-download-size", download_max_str);
+	ret = fastboot_publish_dynamic("max-download-size", get_max_download_size_var);
 	if (EFI_ERROR(ret))
 		goto error;
 
@@ -1402,6 +1761,30 @@ static EFI_STATUS fastboot_init()
 	if (EFI_ERROR(ret))
 		goto error;
 
+	ret = fastboot_publish_dynamic("flash-flush-count", get_flash_flush_count_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("flash-flush-time", get_flash_flush_time_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("log-dropped", get_log_dropped_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("tcp-rx-throughput", get_tcp_rx_throughput_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("usb-rx-completions", get_usb_rx_completions_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("usb-rx-throughput", get_usb_rx_throughput_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
 	ret = publish_partsize();
 	if (EFI_ERROR(ret))
 		goto error;
@@ -1523,7 +1906,9 @@ EFI_STATUS fastboot_start(void **bootimage, void **efiimage, UINTN *imagesize,
 			}
 		}
 
+		fastboot_process_stream();
 		fastboot_run_command();
+		log_drain();
 
 		if (fastboot_state == STATE_STOPPED)
 			break;
@@ -1578,6 +1963,7 @@ EFI_STATUS fastboot_stop(void *bootimage, void *efiimage, UINTN imagesize,
 
 void fastboot_free()
 {
+	stream_free();
 	if (dl.data) {
 		FreePool(dl.data);
 		dl.data = NULL;
@@ -56,6 +56,7 @@
 #include "vars.h"
 #include "security_interface.h"
 #include "fatfs.h"
+#include "trace.h"
 #define OFF_MODE_CHARGE		"off-mode-charge"
 #define CRASH_EVENT_MENU	"crash-event-menu"
 #define SLOT_FALLBACK		"slot-fallback"
@@ -311,16 +312,24 @@ static void cmd_oem_gethashes(INTN argc, CHAR8 **argv)
 		}
 	}
 
+	hash_batch_begin();
 	for (i = 0; i < ARRAY_SIZE(OEM_HASH); i++) {
 		ret = OEM_HASH[i].hash(slot_label(OEM_HASH[i].name));
 		if (EFI_ERROR(ret)
 		    && (ret != EFI_NOT_FOUND || OEM_HASH[i].fail_if_missing)) {
+			hash_batch_discard();
 			fastboot_fail("Failed to get hash for %s, %r",
 				      OEM_HASH[i].name, ret);
 			return;
 		}
 	}
 
+	ret = hash_batch_end();
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to hash partitions, %r", ret);
+		return;
+	}
+
 	fastboot_okay("");
 }
 
@@ -610,6 +619,33 @@ static void cmd_oem_get_logs(INTN argc, __attribute__((__unused__)) CHAR8 **argv
 	fastboot_okay("");
 }
 
+static void cmd_oem_get_trace(INTN argc, __attribute__((__unused__)) CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	CHAR8 *json;
+	UINTN len;
+
+	if (argc != 1) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	ret = trace_to_json(&json, &len);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to export the trace buffer, %r", ret);
+		return;
+	}
+
+	ret = parse_text_buffer(json, len, fastboot_info_long_string, NULL);
+	FreePool(json);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to parse trace buffer, %r", ret);
+		return;
+	}
+
+	fastboot_okay("");
+}
+
 static void cmd_oem(INTN argc, CHAR8 **argv)
 {
 	if (argc < 2) {
@@ -750,6 +786,24 @@ static void cmd_fuse_tpm2_provision_trusty_seed(INTN argc, __attribute__((__unus
 	fastboot_okay("");
 }
 
+static void cmd_oem_stream_flash(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+
+	if (argc > 2) {
+		fastboot_fail("Invalid parameters, Usage: fastboot oem stream-flash [<partition>]");
+		return;
+	}
+
+	ret = fastboot_stream_flash(argc == 2 ? argv[1] : NULL);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to arm streamed flash, %r", ret);
+		return;
+	}
+
+	fastboot_okay("");
+}
+
 static CHAR16 *saved_vm_label;
 static void cmd_oem_set_vm(INTN argc, CHAR8 **argv)
 {
@@ -807,8 +861,10 @@ static struct fastboot_cmd COMMANDS[] = {
 #endif
 	{ "get-hashes",			LOCKED,		cmd_oem_gethashes  },
 	{ "get-provisioning-logs",	LOCKED,		cmd_oem_get_logs },
+	{ "get-trace",			LOCKED,		cmd_oem_get_trace },
 	{ "setvm",			LOCKED,		cmd_oem_set_vm },
 	{ "unsetvm",			LOCKED,		cmd_oem_unset_vm },
+	{ "stream-flash",		UNLOCKED,	cmd_oem_stream_flash },
 #ifndef USER
 	{ "tpm-show-index",		LOCKED,		cmd_oem_tpm_show_index },
 	{ "tpm-delete-index",		LOCKED,		cmd_oem_tpm_delete_index },
@@ -43,7 +43,9 @@
 #define FASTBOOT_STR_CONFIGURATION	L"USB-Update"
 #define FASTBOOT_STR_INTERFACE		L"Fastboot"
 
-static const UINT32 BLK_DOWNLOAD = 8 * 1024 * 1024;
+/* The USB layer splits large reads in a chain of smaller requests, the
+   limit only sets how often the download progress is updated.  */
+static const UINT32 BLK_DOWNLOAD = 64 * 1024 * 1024;
 
 static EFI_STATUS fastboot_usb_start(start_callback_t start_cb,
 				     data_callback_t rx_cb,
@@ -44,6 +44,7 @@
 #include "gpt_bin.h"
 #include "flash.h"
 #include "storage.h"
+#include "storage_io.h"
 #include "sparse.h"
 #include "oemvars.h"
 #include "vars.h"
@@ -59,6 +60,7 @@
 #endif
 #include "fatfs.h"
 #include "embedded_controller.h"
+#include "timer.h"
 extern uint64_t vm_offset;
 static struct gpt_partition_interface gparti;
 static struct gpt_partition_interface vm_gparti;
@@ -68,6 +70,23 @@ static BOOLEAN userdata_erased = FALSE;
 static BOOLEAN share_data_erased = FALSE;
 BOOLEAN new_install_device = FALSE;
 
+/* Inside a write session, the storage cache is only flushed when the
+   session is committed or, if FLASH_FLUSH_THRESHOLD is not zero, each
+   time that many bytes have been written since the last flush.  */
+#ifndef FLASH_FLUSH_THRESHOLD
+#define FLASH_FLUSH_THRESHOLD 0
+#endif
+static struct flash_session {
+	BOOLEAN active;
+	UINT64 unflushed;
+} session;
+static UINT64 flush_count;
+static UINT64 flush_ticks;
+
+/* While a stream is being flashed, flash_write_queued() only queues
+   the writes on this storage I/O queue.  */
+static struct storage_io *queue;
+
 #define part_start (p_gparti->part.starting_lba * p_gparti->bio->Media->BlockSize)
 #define part_end ((p_gparti->part.ending_lba + 1) * p_gparti->bio->Media->BlockSize)
 
@@ -85,6 +104,55 @@ EFI_STATUS flash_skip(UINT64 size)
 	return EFI_SUCCESS;
 }
 
+static EFI_STATUS flash_flush(void)
+{
+	EFI_STATUS ret;
+	UINT64 start;
+
+	if (queue) {
+		ret = storage_io_sync(queue);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	start = rdtsc();
+	ret = uefi_call_wrapper(p_gparti->bio->FlushBlocks, 1, p_gparti->bio);
+	flush_ticks += rdtsc() - start;
+	flush_count++;
+	session.unflushed = 0;
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to flush the storage cache");
+
+	return ret;
+}
+
+void flash_session_begin(void)
+{
+	session.active = TRUE;
+	session.unflushed = 0;
+}
+
+EFI_STATUS flash_session_commit(void)
+{
+	if (!session.active)
+		return EFI_SUCCESS;
+
+	session.active = FALSE;
+	return session.unflushed ? flash_flush() : EFI_SUCCESS;
+}
+
+void flash_get_flush_stats(UINT64 *count, UINT64 *time_ms)
+{
+	UINT32 tsc_mhz;
+
+	tsc_mhz = get_tsc_mhz();
+	if (tsc_mhz == 0)
+		tsc_mhz = get_cpu_freq();
+
+	*count = flush_count;
+	*time_ms = tsc_mhz ? flush_ticks / tsc_mhz / 1000 : 0;
+}
+
 EFI_STATUS flash_write(VOID *data, UINTN size)
 {
 	EFI_STATUS ret;
@@ -97,16 +165,60 @@ EFI_STATUS flash_write(VOID *data, UINTN size)
 				part_start, part_end, cur_offset, cur_offset + size);
 		return EFI_INVALID_PARAMETER;
 	}
-	ret = uefi_call_wrapper(p_gparti->dio->WriteDisk, 5, p_gparti->dio, p_gparti->bio->Media->MediaId, vm_offset + cur_offset, size, data);
+	ret = storage_write(p_gparti, vm_offset + cur_offset, size, data);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to write bytes");
 		return ret;
 	}
 
 	cur_offset += size;
-	ret = uefi_call_wrapper(gparti.bio->FlushBlocks, 1, gparti.bio);
+	if (!session.active)
+		return flash_flush();
 
-	return ret;
+	session.unflushed += size;
+#if FLASH_FLUSH_THRESHOLD
+	if (session.unflushed >= FLASH_FLUSH_THRESHOLD)
+		return flash_flush();
+#endif
+
+	return EFI_SUCCESS;
+}
+
+/* Same as flash_write() but, while a stream is being flashed, the
+   write is only queued: DATA must remain valid until
+   flash_stream_sync() or flash_stream_end() returns.  */
+EFI_STATUS flash_write_queued(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+	UINTN chunk;
+
+	if (!queue)
+		return flash_write(data, size);
+
+	if (!is_inside_partition(cur_offset, size)) {
+		error(L"Attempt to write outside of partition [%ld %ld] [%ld %ld]",
+				part_start, part_end, cur_offset, cur_offset + size);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	for (; size; size -= chunk) {
+		chunk = min(size, (UINTN)STORAGE_IO_CHUNK);
+		ret = storage_io_write(queue, vm_offset + cur_offset, chunk, data);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to write bytes");
+			return ret;
+		}
+		cur_offset += chunk;
+		data = (UINT8 *)data + chunk;
+		session.unflushed += chunk;
+	}
+
+#if FLASH_FLUSH_THRESHOLD
+	if (session.unflushed >= FLASH_FLUSH_THRESHOLD)
+		return flash_flush();
+#endif
+
+	return EFI_SUCCESS;
 }
 
 EFI_STATUS flash_fill(UINT32 pattern, UINTN size)
@@ -450,11 +562,28 @@ static EFI_STATUS flash_ramdisk(VOID *data, UINTN size)
 static CHAR16 *DM_VERITY_PARTITIONS[] =
 	{ SYSTEM_LABEL, VENDOR_LABEL, OEM_LABEL };
 
-EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
+static EFI_STATUS flash_partition_done(CHAR16 *label)
 {
 	EFI_STATUS ret;
 	UINTN i;
 
+	if (!CompareGuid(&p_gparti->part.type, &EfiPartTypeSystemPartitionGuid)) {
+		ret = gpt_refresh();
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(DM_VERITY_PARTITIONS); i++)
+		if (!StrCmp(DM_VERITY_PARTITIONS[i], label))
+			return slot_set_verity_corrupted(FALSE);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
+{
+	EFI_STATUS ret, ret_commit;
+
 	debug(L"flash partition label = %s\n", label);
 	ret = gpt_get_partition_by_label(label, p_gparti, LOGICAL_UNIT_USER);
 	if (EFI_ERROR(ret)) {
@@ -464,25 +593,19 @@ EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
 
 	cur_offset = p_gparti->part.starting_lba * p_gparti->bio->Media->BlockSize;
 
+	flash_session_begin();
 	if (is_sparse_image(data, size))
 		ret = flash_sparse(data, size);
 	else
 		ret = flash_write(data, size);
 
+	ret_commit = flash_session_commit();
 	if (EFI_ERROR(ret))
 		return ret;
+	if (EFI_ERROR(ret_commit))
+		return ret_commit;
 
-	if (!CompareGuid(&p_gparti->part.type, &EfiPartTypeSystemPartitionGuid)) {
-		ret = gpt_refresh();
-		if (EFI_ERROR(ret))
-			return ret;
-	}
-
-	for (i = 0; i < ARRAY_SIZE(DM_VERITY_PARTITIONS); i++)
-		if (!StrCmp(DM_VERITY_PARTITIONS[i], label))
-			return slot_set_verity_corrupted(FALSE);
-
-	return EFI_SUCCESS;
+	return flash_partition_done(label);
 }
 
 static struct label_exception {
@@ -538,6 +661,160 @@ EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
 	return flash_partition(data, size, full_label);
 }
 
+/* Streamed flashing: the image is written while it is still being
+   received.  Only regular partitions are supported, special labels
+   need the whole image at once.  */
+static struct flash_stream {
+	CHAR16 *label;
+	BOOLEAN started;
+	BOOLEAN sparse;
+	struct sparse_stream sparse_ctx;
+} stream;
+
+BOOLEAN flash_stream_supported(const CHAR16 *label)
+{
+	UINTN i;
+
+	if (!StrnCmp(L"/ESP/", label, StrLen(L"/ESP/")))
+		return FALSE;
+
+	for (i = 0; i < ARRAY_SIZE(LABEL_EXCEPTIONS); i++)
+		if (!StrCmp(LABEL_EXCEPTIONS[i].name, label))
+			return FALSE;
+
+	return TRUE;
+}
+
+EFI_STATUS flash_stream_begin(CHAR16 *label)
+{
+	EFI_STATUS ret;
+	CHAR16 *full_label;
+
+	if (!label)
+		return EFI_INVALID_PARAMETER;
+
+	if (!flash_stream_supported(label))
+		return EFI_UNSUPPORTED;
+
+	if (stream.label) {
+		debug(L"Discarding unfinished %s stream", stream.label);
+		flash_stream_abort();
+	}
+
+	full_label = (CHAR16 *)slot_label(label);
+	if (!full_label) {
+		error(L"invalid bootloader label");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	ret = gpt_get_partition_by_label(full_label, p_gparti, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get partition %s", full_label);
+		return ret;
+	}
+
+	stream.label = StrDuplicate(full_label);
+	if (!stream.label)
+		return EFI_OUT_OF_RESOURCES;
+
+	cur_offset = p_gparti->part.starting_lba * p_gparti->bio->Media->BlockSize;
+	stream.started = FALSE;
+	stream.sparse = FALSE;
+	flash_session_begin();
+
+	ret = storage_io_open(p_gparti, &queue);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to open a storage I/O queue, writing synchronously");
+		queue = NULL;
+	}
+
+	return EFI_SUCCESS;
+}
+
+const CHAR16 *flash_stream_label(void)
+{
+	return stream.label;
+}
+
+static EFI_STATUS stream_close_queue(void)
+{
+	EFI_STATUS ret;
+
+	if (!queue)
+		return EFI_SUCCESS;
+
+	ret = storage_io_close(queue);
+	queue = NULL;
+	return ret;
+}
+
+EFI_STATUS flash_stream_sync(void)
+{
+	return queue ? storage_io_sync(queue) : EFI_SUCCESS;
+}
+
+void flash_stream_abort(void)
+{
+	if (!stream.label)
+		return;
+
+	if (stream.started && stream.sparse)
+		sparse_stream_finish(&stream.sparse_ctx);
+	stream_close_queue();
+	flash_session_commit();
+
+	FreePool(stream.label);
+	stream.label = NULL;
+}
+
+EFI_STATUS flash_stream_write(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+
+	if (!stream.label)
+		return EFI_NOT_STARTED;
+
+	if (!stream.started) {
+		stream.started = TRUE;
+		stream.sparse = size >= sizeof(UINT32) &&
+			*(UINT32 *)data == SPARSE_HEADER_MAGIC;
+		if (stream.sparse) {
+			ret = sparse_stream_init(&stream.sparse_ctx);
+			if (EFI_ERROR(ret))
+				return ret;
+		}
+	}
+
+	if (stream.sparse)
+		return sparse_stream_feed(&stream.sparse_ctx, data, size);
+
+	return flash_write_queued(data, size);
+}
+
+EFI_STATUS flash_stream_end(void)
+{
+	EFI_STATUS ret = EFI_SUCCESS, ret_io, ret_commit;
+	CHAR16 *label = stream.label;
+
+	if (!label)
+		return EFI_NOT_STARTED;
+
+	stream.label = NULL;
+	if (stream.started && stream.sparse)
+		ret = sparse_stream_finish(&stream.sparse_ctx);
+	ret_io = stream_close_queue();
+	if (!EFI_ERROR(ret))
+		ret = ret_io;
+	ret_commit = flash_session_commit();
+	if (!EFI_ERROR(ret))
+		ret = ret_commit;
+	if (!EFI_ERROR(ret))
+		ret = flash_partition_done(label);
+
+	FreePool(label);
+	return ret;
+}
+
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label)
 {
 	EFI_STATUS ret;
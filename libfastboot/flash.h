@@ -41,7 +41,11 @@ extern BOOLEAN new_install_device;
 
 EFI_STATUS flash_skip(UINT64 size);
 EFI_STATUS flash_write(VOID *data, UINTN size);
+EFI_STATUS flash_write_queued(VOID *data, UINTN size);
 EFI_STATUS flash_fill(UINT32 pattern, UINTN size);
+void flash_session_begin(void);
+EFI_STATUS flash_session_commit(void);
+void flash_get_flush_stats(UINT64 *count, UINT64 *time_ms);
 
 /* return value for flash() function */
 
@@ -49,6 +53,13 @@ EFI_STATUS flash_fill(UINT32 pattern, UINTN size);
 
 EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label);
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label);
+BOOLEAN flash_stream_supported(const CHAR16 *label);
+EFI_STATUS flash_stream_begin(CHAR16 *label);
+const CHAR16 *flash_stream_label(void);
+EFI_STATUS flash_stream_write(VOID *data, UINTN size);
+EFI_STATUS flash_stream_sync(void);
+EFI_STATUS flash_stream_end(void);
+void flash_stream_abort(void);
 EFI_STATUS erase_by_label(CHAR16 *label);
 EFI_STATUS garbage_disk(void);
 EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label);
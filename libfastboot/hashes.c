@@ -41,8 +41,10 @@
 #include "fastboot.h"
 #include "uefi_utils.h"
 #include "gpt.h"
+#include "storage_io.h"
 #include "android.h"
 #include "security.h"
+#include "timer.h"
 #if defined(USE_ACPIO) || defined(USE_ACPI)
 #include "acpi.h"
 #endif
@@ -382,42 +384,216 @@ struct fec_header {
 };
 
 
-#define CHUNK 1024 * 1024
+#define CHUNK (1024 * 1024)
 #define MIN(a, b) ((a < b) ? (a) : (b))
-static EFI_STATUS hash_partition(struct gpt_partition_interface *gparti, UINT64 len, CHAR8 *hash)
-{
-	EVP_MD_CTX mdctx;
+
+/* Partitions hashed while a batch is open are read concurrently, each
+ * one with its own queue of STORAGE_IO_DEPTH requests, and hashed
+ * round-robin as their chunks land.  The hashes are reported when the
+ * batch is run.  */
+#define HASH_BATCH_MAX 4
+
+static struct hash_job {
+	struct gpt_partition_interface gparti;
+	CHAR16 name[GPT_NAME_LEN];
+	UINT64 len;
+	UINT64 queued;
+	UINT64 hashed;
+	struct storage_io *io;
 	CHAR8 *buffer;
-	UINT64 offset;
-	UINT64 chunklen;
-	EFI_STATUS ret = EFI_INVALID_PARAMETER;
+	EVP_MD_CTX mdctx;
+	CHAR8 hash[EVP_MAX_MD_SIZE];
+	UINT64 ticks;
+	EFI_STATUS ret;
+} jobs[HASH_BATCH_MAX];
+static UINTN nb_jobs;
+static BOOLEAN batch_active;
+
+static EFI_STATUS hash_job_submit(struct hash_job *job)
+{
+	UINT64 partoffset;
+	UINTN size;
+	CHAR8 *buf;
+
+	partoffset = job->gparti.part.starting_lba *
+		job->gparti.bio->Media->BlockSize;
+	size = MIN(job->len - job->queued, CHUNK);
+	buf = job->buffer + (job->queued / CHUNK % STORAGE_IO_DEPTH) * CHUNK;
 
-	buffer = AllocatePool(CHUNK);
-	if (!buffer)
+	job->ret = storage_io_read(job->io, partoffset + job->queued, size, buf);
+	job->queued += size;
+	return job->ret;
+}
+
+static EFI_STATUS hash_job_start(struct hash_job *job)
+{
+	if (job->len > get_partition_size(&job->gparti)) {
+		debug(L"attempt to read outside of partition %s", job->name);
+		return EFI_END_OF_MEDIA;
+	}
+
+	job->buffer = AllocatePool(STORAGE_IO_DEPTH * CHUNK);
+	if (!job->buffer)
 		return EFI_OUT_OF_RESOURCES;
 
+	job->ret = storage_io_open(&job->gparti, &job->io);
+	if (EFI_ERROR(job->ret))
+		return job->ret;
+
+	while (job->queued < job->len &&
+	       job->queued - job->hashed < STORAGE_IO_DEPTH * CHUNK)
+		if (EFI_ERROR(hash_job_submit(job)))
+			break;
+
+	return job->ret;
+}
+
+/* Wait for the oldest chunk of JOB, hash it and queue the next one.
+ * Return TRUE when JOB is complete.  */
+static BOOLEAN hash_job_step(struct hash_job *job)
+{
+	UINTN size;
+	CHAR8 *buf;
+
+	job->ret = storage_io_wait(job->io);
+	if (EFI_ERROR(job->ret))
+		return TRUE;
+
+	size = MIN(job->len - job->hashed, CHUNK);
+	buf = job->buffer + (job->hashed / CHUNK % STORAGE_IO_DEPTH) * CHUNK;
+	EVP_DigestUpdate(&job->mdctx, buf, size);
+	job->hashed += size;
+
+	if (job->hashed == job->len)
+		return TRUE;
+
+	if (job->queued < job->len && EFI_ERROR(hash_job_submit(job)))
+		return TRUE;
+
+	return FALSE;
+}
+
+static void report_throughput(struct hash_job *job)
+{
+	UINT32 tsc_mhz;
+	UINT64 us;
+
+	tsc_mhz = get_tsc_mhz();
+	if (tsc_mhz == 0)
+		tsc_mhz = get_cpu_freq();
+	if (!tsc_mhz)
+		return;
+
+	us = job->ticks / tsc_mhz;
+	fastboot_info("%s: %ld bytes in %ld ms, %ld KiB/s", job->name,
+		      job->len, us / 1000,
+		      us ? job->len * 1000000 / 1024 / us : 0);
+}
+
+static EFI_STATUS hash_batch_run(void)
+{
+	EFI_STATUS ret = EFI_SUCCESS, close_ret;
+	BOOLEAN done[HASH_BATCH_MAX];
+	UINTN i, remaining;
+	UINT64 start;
+
 	if (!selected_md)
 		set_hash_algorithm(NULL);
 
-	EVP_MD_CTX_init(&mdctx);
-	EVP_DigestInit_ex(&mdctx, selected_md, NULL);
+	start = rdtsc();
+	remaining = 0;
+	for (i = 0; i < nb_jobs; i++) {
+		EVP_MD_CTX_init(&jobs[i].mdctx);
+		EVP_DigestInit_ex(&jobs[i].mdctx, selected_md, NULL);
+		jobs[i].ret = hash_job_start(&jobs[i]);
+		done[i] = EFI_ERROR(jobs[i].ret) || jobs[i].len == 0;
+		if (!done[i])
+			remaining++;
+	}
+
+	while (remaining) {
+		for (i = 0; i < nb_jobs; i++) {
+			if (done[i] || !hash_job_step(&jobs[i]))
+				continue;
+			done[i] = TRUE;
+			jobs[i].ticks = rdtsc() - start;
+			remaining--;
+		}
+	}
+
+	for (i = 0; i < nb_jobs; i++) {
+		if (jobs[i].io) {
+			close_ret = storage_io_close(jobs[i].io);
+			if (!EFI_ERROR(jobs[i].ret))
+				jobs[i].ret = close_ret;
+		}
+		if (!EFI_ERROR(jobs[i].ret) &&
+		    !EVP_DigestFinal_ex(&jobs[i].mdctx, jobs[i].hash, NULL))
+			jobs[i].ret = EFI_DEVICE_ERROR;
+		EVP_MD_CTX_cleanup(&jobs[i].mdctx);
+		if (jobs[i].buffer)
+			FreePool(jobs[i].buffer);
+
+		if (EFI_ERROR(jobs[i].ret)) {
+			efi_perror(jobs[i].ret, L"Failed to hash partition %s",
+				   jobs[i].name);
+			if (!EFI_ERROR(ret))
+				ret = jobs[i].ret;
+			continue;
+		}
 
-	for (offset = 0; offset < len; offset += CHUNK) {
-		chunklen = MIN(len - offset, CHUNK);
-		ret = read_partition(gparti, offset, chunklen, buffer);
 		if (EFI_ERROR(ret))
-			goto free;
-		EVP_DigestUpdate(&mdctx, buffer, chunklen);
+			continue;
+		ret = report_hash(L"/", jobs[i].name, jobs[i].hash);
+		if (!EFI_ERROR(ret))
+			report_throughput(&jobs[i]);
 	}
-	if (!EVP_DigestFinal_ex(&mdctx, hash, NULL))
-		goto free;
 
-free:
-	EVP_MD_CTX_cleanup(&mdctx);
-	FreePool(buffer);
+	nb_jobs = 0;
 	return ret;
 }
 
+void hash_batch_begin(void)
+{
+	nb_jobs = 0;
+	batch_active = TRUE;
+}
+
+EFI_STATUS hash_batch_end(void)
+{
+	batch_active = FALSE;
+	return hash_batch_run();
+}
+
+void hash_batch_discard(void)
+{
+	batch_active = FALSE;
+	nb_jobs = 0;
+}
+
+/* Hash the first LEN bytes of GPARTI and report them as NAME.  In a
+ * batch, the partition is only queued.  */
+static EFI_STATUS hash_partition(struct gpt_partition_interface *gparti, UINT64 len,
+				 const CHAR16 *name)
+{
+	struct hash_job *job;
+	EFI_STATUS ret;
+
+	if (nb_jobs == HASH_BATCH_MAX) {
+		ret = hash_batch_run();
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	job = &jobs[nb_jobs++];
+	memset(job, 0, sizeof(*job));
+	memcpy(&job->gparti, gparti, sizeof(job->gparti));
+	StrNCpy(job->name, name, ARRAY_SIZE(job->name) - 1);
+	job->len = len;
+
+	return batch_active ? EFI_SUCCESS : hash_batch_run();
+}
+
 static const unsigned char IAS_IMAGE_MAGIC[4] = "ipk.";
 static const unsigned char MULTIBOOT_MAGIC[4] = "\x02\xb0\xad\x1b";
 
@@ -559,7 +735,6 @@ EFI_STATUS get_ias_image_hash(const CHAR16 *label)
 {
 	struct gpt_partition_interface gparti;
 	UINT64 len;
-	CHAR8 hash[EVP_MAX_MD_SIZE];
 	EFI_STATUS ret;
 
 	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
@@ -572,11 +747,7 @@ EFI_STATUS get_ias_image_hash(const CHAR16 *label)
 	if (EFI_ERROR(ret))
 		return ret;
 
-	ret = hash_partition(&gparti, len, hash);
-	if (EFI_ERROR(ret))
-		return ret;
-
-	return report_hash(L"/", label, hash);
+	return hash_partition(&gparti, len, label);
 }
 #endif
 
@@ -584,7 +755,6 @@ EFI_STATUS get_boot_image_hash(const CHAR16 *label)
 {
 	struct gpt_partition_interface gparti;
 	UINT64 len;
-	CHAR8 hash[EVP_MAX_MD_SIZE];
 	EFI_STATUS ret;
 
 	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
@@ -603,18 +773,13 @@ EFI_STATUS get_boot_image_hash(const CHAR16 *label)
 		}
 	}
 
-	ret = hash_partition(&gparti, len, hash);
-	if (EFI_ERROR(ret))
-		return ret;
-
-	return report_hash(L"/", label, hash);
+	return hash_partition(&gparti, len, label);
 }
 
 EFI_STATUS get_vbmeta_image_hash(const CHAR16 *label)
 {
 	struct gpt_partition_interface gparti;
 	UINT64 len;
-	CHAR8 hash[EVP_MAX_MD_SIZE];
 	EFI_STATUS ret;
 
 	/*
@@ -629,11 +794,7 @@ EFI_STATUS get_vbmeta_image_hash(const CHAR16 *label)
 		return ret;
 	}
 
-	ret = hash_partition(&gparti, len, hash);
-	if (EFI_ERROR(ret))
-		return ret;
-
-	return report_hash(L"/", label, hash);
+	return hash_partition(&gparti, len, label);
 }
 
 static EFI_STATUS get_ext4_len(struct gpt_partition_interface *gparti, UINT64 *len)
@@ -694,7 +855,6 @@ EFI_STATUS get_super_image_hash(const CHAR16 *label)
 {
 	struct gpt_partition_interface gpart;
 	EFI_STATUS ret;
-	CHAR8 hash[EVP_MAX_MD_SIZE];
 	UINT64 len;
 
 	ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
@@ -704,12 +864,7 @@ EFI_STATUS get_super_image_hash(const CHAR16 *label)
 	}
 
 	len = get_partition_size(&gpart);
-	ret = hash_partition(&gpart, len, hash);
-	if (EFI_ERROR(ret)) {
-		return ret;
-	}
-
-	return report_hash(L"/", gpart.part.name, hash);
+	return hash_partition(&gpart, len, gpart.part.name);
 }
 #endif
 
@@ -724,7 +879,6 @@ EFI_STATUS get_fs_hash(const CHAR16 *label)
 		{ "Ias", get_iasimage_len }
 	};
 	struct gpt_partition_interface gparti;
-	CHAR8 hash[EVP_MAX_MD_SIZE];
 	EFI_STATUS ret;
 	UINT64 fs_len;
 	UINTN i;
@@ -752,10 +906,7 @@ EFI_STATUS get_fs_hash(const CHAR16 *label)
 		fs_len = get_partition_size(&gparti);
 	debug(L"filesystem size %lld", fs_len);
 
-	ret = hash_partition(&gparti, fs_len, hash);
-	if (EFI_ERROR(ret))
-		return ret;
-	return report_hash(L"/", gparti.part.name, hash);
+	return hash_partition(&gparti, fs_len, gparti.part.name);
 }
 
 #if defined(USE_ACPIO) || defined(USE_ACPI)
@@ -763,7 +914,6 @@ EFI_STATUS get_acpi_hash(const CHAR16 *label)
 {
 	EFI_STATUS ret;
 	struct gpt_partition_interface gpart;
-	CHAR8 hash[EVP_MAX_MD_SIZE];
 	struct ACPI_INFO *acpi_info;
 
 	ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
@@ -778,13 +928,8 @@ EFI_STATUS get_acpi_hash(const CHAR16 *label)
 		return ret;
 	}
 
-	ret = hash_partition(&gpart, (*acpi_info).img_size, hash);
-	if (EFI_ERROR(ret)) {
-		FreePool(acpi_info);
-		return ret;
-	}
-
+	ret = hash_partition(&gpart, (*acpi_info).img_size, label);
 	FreePool(acpi_info);
-	return report_hash(L"/", label, hash);
+	return ret;
 }
 #endif
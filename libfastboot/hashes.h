@@ -43,6 +43,13 @@ EFI_STATUS get_boot_image_hash(const CHAR16 *label);
 EFI_STATUS get_bootloader_hash(const CHAR16 *label);
 EFI_STATUS get_fs_hash(const CHAR16 *label);
 EFI_STATUS set_hash_algorithm(const CHAR8 *algo);
+
+/* Partitions hashed between hash_batch_begin() and hash_batch_end()
+ * are read and hashed concurrently.  Their hashes are reported by
+ * hash_batch_end(), or dropped by hash_batch_discard().  */
+void hash_batch_begin(void);
+EFI_STATUS hash_batch_end(void);
+void hash_batch_discard(void);
 #if defined(USE_ACPIO) || defined(USE_ACPI)
 EFI_STATUS get_acpi_hash(const CHAR16 *label);
 #endif
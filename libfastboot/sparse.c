@@ -39,6 +39,7 @@
 
 #include "flash.h"
 #include "sparse_format.h"
+#include "sparse.h"
 
 /* Hunks buffer size.  */
 static const unsigned int BUFFER_SIZE = 10 * 1024 * 1024;
@@ -47,6 +48,10 @@ static const unsigned int BUFFER_SIZE = 10 * 1024 * 1024;
 static const unsigned int HUNK_SIZE_THRESHOLD = 1024 * 1024;
 static void *buffer;
 static unsigned int cur_size;
+/* Direct writes of large hunks are kept aligned on this size: when a
+   raw chunk is fed in several pieces, the unaligned end of a piece is
+   buffered and written with the beginning of the next one.  */
+static unsigned int align = 1;
 
 BOOLEAN is_sparse_image(void *data, UINT64 size)
 {
@@ -107,22 +112,67 @@ static EFI_STATUS flush_buffer()
 	return ret;
 }
 
+/* Write the aligned part of the buffer and move the remaining bytes
+   to its beginning.  */
+static EFI_STATUS flush_buffer_aligned()
+{
+	EFI_STATUS ret;
+	unsigned int tail = cur_size % align;
+
+	if (cur_size == tail)
+		return EFI_SUCCESS;
+
+	ret = flash_write(buffer, cur_size - tail);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	CopyMem(buffer, buffer + cur_size - tail, tail);
+	cur_size = tail;
+	return EFI_SUCCESS;
+}
+
 static EFI_STATUS flash_raw_data(void *data, unsigned size)
 {
 	EFI_STATUS ret;
+	unsigned int n;
 
 	if (!buffer)
-		return flash_write(data, size);
+		return flash_write_queued(data, size);
 
 	if (size > HUNK_SIZE_THRESHOLD) {
+		/* Complete the buffered data up to an aligned size so
+		   that the direct write starts aligned.  */
+		if (cur_size % align) {
+			if (cur_size + align > BUFFER_SIZE) {
+				ret = flush_buffer_aligned();
+				if (EFI_ERROR(ret))
+					return ret;
+			}
+			n = align - cur_size % align;
+			CopyMem(buffer + cur_size, data, n);
+			cur_size += n;
+			data += n;
+			size -= n;
+		}
+
 		ret = flush_buffer();
 		if (EFI_ERROR(ret))
 			return ret;
-		return flash_write(data, size);
+
+		n = size % align;
+		if (size > n) {
+			ret = flash_write_queued(data, size - n);
+			if (EFI_ERROR(ret))
+				return ret;
+		}
+
+		CopyMem(buffer, data + size - n, n);
+		cur_size = n;
+		return EFI_SUCCESS;
 	}
 
 	if (size + cur_size > BUFFER_SIZE) {
-		ret = flush_buffer();
+		ret = flush_buffer_aligned();
 		if (EFI_ERROR(ret))
 			return ret;
 	}
@@ -136,76 +186,216 @@ static EFI_STATUS flash_raw_data(void *data, unsigned size)
 	return EFI_SUCCESS;
 }
 
-static EFI_STATUS flash_chunk(struct sparse_header *sph, struct chunk_header *ckh, CHAR8 *data, unsigned int size)
+/* Accumulate WANT bytes of header in CTX->hdr.  Return TRUE once
+   the header is complete.  */
+static BOOLEAN stream_collect(struct sparse_stream *ctx, CHAR8 **data,
+			      UINTN *len, UINTN want)
+{
+	UINTN n = min(want - ctx->hdr_len, *len);
+
+	CopyMem(ctx->hdr + ctx->hdr_len, *data, n);
+	ctx->hdr_len += n;
+	*data += n;
+	*len -= n;
+
+	if (ctx->hdr_len != want)
+		return FALSE;
+
+	ctx->hdr_len = 0;
+	return TRUE;
+}
+
+static void stream_end_chunk(struct sparse_stream *ctx)
+{
+	ctx->chunk++;
+	ctx->state = ctx->chunk == ctx->sph.total_chunks ?
+		SPARSE_STREAM_DONE : SPARSE_STREAM_CHUNK_HEADER;
+}
+
+static EFI_STATUS stream_file_header(struct sparse_stream *ctx)
+{
+	CopyMem(&ctx->sph, ctx->hdr, sizeof(ctx->sph));
+	if (!is_sparse_image(&ctx->sph, sizeof(ctx->sph))) {
+		error(L"Invalid sparse header");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	ctx->skip = ctx->sph.file_hdr_sz - sizeof(ctx->sph);
+	ctx->chunk = 0;
+	align = ctx->sph.blk_sz && ctx->sph.blk_sz <= HUNK_SIZE_THRESHOLD ?
+		ctx->sph.blk_sz : 1;
+	ctx->state = ctx->sph.total_chunks ?
+		SPARSE_STREAM_CHUNK_HEADER : SPARSE_STREAM_DONE;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS stream_chunk_header(struct sparse_stream *ctx)
 {
 	EFI_STATUS ret;
-	UINT64 chunk_szb = (UINT64)ckh->chunk_sz * (UINT64)sph->blk_sz;
+	struct chunk_header *ckh = &ctx->ckh;
+	UINT64 chunk_szb;
+
+	CopyMem(ckh, ctx->hdr, sizeof(*ckh));
+	if (ckh->total_sz < ctx->sph.chunk_hdr_sz) {
+		error(L"sparse chunk malformated, %d, %d", ckh->total_sz,
+		      ctx->sph.chunk_hdr_sz);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	chunk_szb = (UINT64)ckh->chunk_sz * (UINT64)ctx->sph.blk_sz;
+	ctx->skip = ctx->sph.chunk_hdr_sz - sizeof(*ckh);
+	ctx->remaining = ckh->total_sz - ctx->sph.chunk_hdr_sz;
 
 	switch (ckh->chunk_type) {
 	case CHUNK_TYPE_RAW:
-		if (size % sph->blk_sz || size != chunk_szb) {
+		if (ctx->remaining != chunk_szb) {
 			error(L"inconsistent raw chunk");
 			return EFI_INVALID_PARAMETER;
 		}
-		return flash_raw_data(data, size);
+		if (!ctx->remaining) {
+			stream_end_chunk(ctx);
+			break;
+		}
+		ctx->state = SPARSE_STREAM_CHUNK_RAW;
+		break;
+	case CHUNK_TYPE_FILL:
+		if (ctx->remaining < sizeof(UINT32)) {
+			error(L"sparse fill chunk truncated");
+			return EFI_INVALID_PARAMETER;
+		}
+		ctx->state = SPARSE_STREAM_CHUNK_FILL;
+		break;
 	case CHUNK_TYPE_DONT_CARE:
 		ret = flush_buffer();
 		if (EFI_ERROR(ret))
 			return ret;
-		return flash_skip(chunk_szb);
-	case CHUNK_TYPE_FILL:
-		ret = flush_buffer();
+		ret = flash_skip(chunk_szb);
 		if (EFI_ERROR(ret))
 			return ret;
-		return flash_fill(*((UINT32 *) data), chunk_szb);
+		ctx->skip += ctx->remaining;
+		stream_end_chunk(ctx);
+		break;
 	case CHUNK_TYPE_CRC32:
-		debug(L"crc chunk not implemented yet %d", size);
+		debug(L"crc chunk not implemented yet %ld", ctx->remaining);
+		ctx->skip += ctx->remaining;
+		stream_end_chunk(ctx);
 		break;
 	default:
 		error(L"Unknow chunk type %04x", ckh->chunk_type);
 		return EFI_INVALID_PARAMETER;
 	}
+
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS flash_sparse(void *data, UINT64 size)
+static EFI_STATUS stream_chunk_fill(struct sparse_stream *ctx)
 {
-	struct sparse_header *sph;
-	CHAR8 *s;
-	UINT64 rlen;
-	unsigned int i;
-	EFI_STATUS ret_flush_buffer, ret = EFI_SUCCESS;
+	EFI_STATUS ret;
+	UINT32 pattern;
 
-	rlen = size;
-	s = data;
-	sph = data;
-	s += sph->file_hdr_sz;
+	CopyMem(&pattern, ctx->hdr, sizeof(pattern));
+	ret = flush_buffer();
+	if (EFI_ERROR(ret))
+		return ret;
 
+	ret = flash_fill(pattern, (UINT64)ctx->ckh.chunk_sz * ctx->sph.blk_sz);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ctx->skip = ctx->remaining - sizeof(pattern);
+	stream_end_chunk(ctx);
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS sparse_stream_init(struct sparse_stream *ctx)
+{
+	if (!ctx)
+		return EFI_INVALID_PARAMETER;
+
+	ZeroMem(ctx, sizeof(*ctx));
+	ctx->state = SPARSE_STREAM_FILE_HEADER;
 	init_buffer();
 
-	for (i = 0; i < sph->total_chunks; i++) {
-		struct chunk_header *ckh;
-		ckh = (struct chunk_header *) s;
+	return EFI_SUCCESS;
+}
 
-		if (rlen < sph->chunk_hdr_sz || rlen < ckh->total_sz) {
-			error(L"sparse chunk truncated, %ld, %ld", rlen, size);
-			ret = EFI_INVALID_PARAMETER;
-			break;
+EFI_STATUS sparse_stream_feed(struct sparse_stream *ctx, void *buf, UINTN len)
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+	CHAR8 *data = buf;
+	UINTN n;
+
+	while (len && !EFI_ERROR(ret)) {
+		if (ctx->skip) {
+			n = min(ctx->skip, (UINT64)len);
+			ctx->skip -= n;
+			data += n;
+			len -= n;
+			continue;
 		}
-		if (ckh->total_sz < sph->chunk_hdr_sz) {
-			error(L"sparse chunk malformated, %d, %d", ckh->total_sz, sph->chunk_hdr_sz);
-			ret = EFI_INVALID_PARAMETER;
+
+		switch (ctx->state) {
+		case SPARSE_STREAM_FILE_HEADER:
+			if (stream_collect(ctx, &data, &len, sizeof(ctx->sph)))
+				ret = stream_file_header(ctx);
 			break;
-		}
-		ret = flash_chunk(sph, ckh, s + sph->chunk_hdr_sz, ckh->total_sz - sph->chunk_hdr_sz);
-		if (EFI_ERROR(ret))
+		case SPARSE_STREAM_CHUNK_HEADER:
+			if (stream_collect(ctx, &data, &len, sizeof(ctx->ckh)))
+				ret = stream_chunk_header(ctx);
 			break;
-
-		s += ckh->total_sz;
-		rlen -= ckh->total_sz;
+		case SPARSE_STREAM_CHUNK_RAW:
+			n = min(ctx->remaining, (UINT64)len);
+			ret = flash_raw_data(data, n);
+			ctx->remaining -= n;
+			data += n;
+			len -= n;
+			if (!ctx->remaining)
+				stream_end_chunk(ctx);
+			break;
+		case SPARSE_STREAM_CHUNK_FILL:
+			if (stream_collect(ctx, &data, &len, sizeof(UINT32)))
+				ret = stream_chunk_fill(ctx);
+			break;
+		case SPARSE_STREAM_DONE:
+			debug(L"Ignoring %d bytes past the end of the sparse image", len);
+			len = 0;
+			break;
+		}
 	}
 
-	ret_flush_buffer = flush_buffer();
+	return ret;
+}
+
+EFI_STATUS sparse_stream_finish(struct sparse_stream *ctx)
+{
+	EFI_STATUS ret;
+
+	ret = flush_buffer();
 	free_buffer();
-	return EFI_ERROR(ret) ? ret : ret_flush_buffer;
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (ctx->state != SPARSE_STREAM_DONE || ctx->skip) {
+		error(L"sparse image truncated, chunk %d/%d", ctx->chunk,
+		      ctx->sph.total_chunks);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS flash_sparse(void *data, UINT64 size)
+{
+	struct sparse_stream ctx;
+	EFI_STATUS ret, ret_finish;
+
+	ret = sparse_stream_init(&ctx);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = sparse_stream_feed(&ctx, data, size);
+	ret_finish = sparse_stream_finish(&ctx);
+
+	return EFI_ERROR(ret) ? ret : ret_finish;
 }
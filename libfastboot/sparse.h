@@ -36,8 +36,35 @@
 #define _SPARSE_H_
 
 #include <efi.h>
+#include "sparse_format.h"
 
-int is_sparse_image(void *data, UINT64 size);
+enum sparse_stream_state {
+	SPARSE_STREAM_FILE_HEADER,
+	SPARSE_STREAM_CHUNK_HEADER,
+	SPARSE_STREAM_CHUNK_RAW,
+	SPARSE_STREAM_CHUNK_FILL,
+	SPARSE_STREAM_DONE
+};
+
+/* Incremental sparse image parser context.  Data can be fed in
+   pieces of any size, headers included, the parser keeps track of
+   its position in the image across calls.  */
+struct sparse_stream {
+	enum sparse_stream_state state;
+	struct sparse_header sph;
+	struct chunk_header ckh;
+	UINT8 hdr[sizeof(struct sparse_header)];
+	UINTN hdr_len;		/* Header bytes collected so far */
+	UINT64 skip;		/* Bytes to drop before the next state */
+	UINT64 remaining;	/* Data bytes left in the current chunk */
+	UINT32 chunk;		/* Index of the current chunk */
+};
+
+BOOLEAN is_sparse_image(void *data, UINT64 size);
 EFI_STATUS flash_sparse(void *data, UINT64 size);
 
+EFI_STATUS sparse_stream_init(struct sparse_stream *ctx);
+EFI_STATUS sparse_stream_feed(struct sparse_stream *ctx, void *buf, UINTN len);
+EFI_STATUS sparse_stream_finish(struct sparse_stream *ctx);
+
 #endif	/* _SPARSE_H_ */
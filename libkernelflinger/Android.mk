@@ -6,6 +6,7 @@ include $(CLEAR_VARS)
 
 PNG2C := $(HOST_OUT_EXECUTABLES)/png2c$(HOST_EXECUTABLE_SUFFIX)
 GEN_FONTS := $(LOCAL_PATH)/tools/gen_fonts.sh
+GEN_IMAGES := $(LOCAL_PATH)/tools/gen_images.sh
 
 res_intermediates := $(call intermediates-dir-for,STATIC_LIBRARIES,libkernelflinger-$(TARGET_BUILD_VARIANT))
 
@@ -22,6 +23,7 @@ endif
 KERNELFLINGER_IMAGES := $(wildcard $(TARGET_KERNELFLINGER_IMAGES_DIR)/*.png)
 KERNELFLINGER_FONTS := $(wildcard $(TARGET_KERNELFLINGER_FONT_DIR)/*.png)
 
+ifeq ($(KERNELFLINGER_PREDECODED_IMAGES),false)
 $(img_res): $(KERNELFLINGER_IMAGES)
 	$(hide) mkdir -p $(dir $@)
 	$(hide) echo "/* Do not modify this auto-generated file. */" > $@
@@ -35,6 +37,11 @@ $(img_res): $(KERNELFLINGER_IMAGES)
 		".data = (UINT8 *)&_binary_"$(subst .,_,$(notdir $(file)))"_start, "\
 		".size = (UINTN)&_binary_"$(subst .,_,$(notdir $(file)))"_size}," >> $@;)
 	$(hide) echo "};" >> $@
+else
+$(img_res): $(KERNELFLINGER_IMAGES) $(PNG2C) $(GEN_IMAGES)
+	$(hide) mkdir -p $(dir $@)
+	$(hide) export PATH=$(HOST_OUT_EXECUTABLES):$$PATH; $(GEN_IMAGES) $(TARGET_KERNELFLINGER_IMAGES_DIR) $@
+endif
 
 $(font_res): $(KERNELFLINGER_FONTS) $(PNG2C) $(GEN_FONTS)
 	$(hide) mkdir -p $(dir $@)
@@ -92,6 +99,10 @@ ifeq ($(KERNELFLINGER_DISABLE_DEBUG_PRINT),true)
     LOCAL_CFLAGS += -D__DISABLE_DEBUG_PRINT
 endif
 
+ifeq ($(KERNELFLINGER_LOG_DEFERRED),true)
+    LOCAL_CFLAGS += -DLOG_DEFERRED
+endif
+
 ifeq ($(MULTI_USER_SUPPORT),true)
     LOCAL_CFLAGS += -DMULTI_USER
 endif
@@ -109,6 +120,7 @@ LOCAL_SRC_FILES := \
 	em.c \
 	gpt.c \
 	storage.c \
+	storage_io.c \
 	pci.c \
 	mmc.c \
 	ufs.c \
@@ -124,6 +136,7 @@ LOCAL_SRC_FILES := \
 	life_cycle.c \
 	qsort.c \
 	timer.c \
+	trace.c \
 	nvme.c \
 	ivshmem.c \
 	virtual_media.c \
@@ -139,6 +152,10 @@ LOCAL_SRC_FILES := \
 	fatfs/source/ffsystem.c \
 	fatfs/source/ffunicode.c
 
+ifneq ($(strip $(KERNELFLINGER_FATFS_CACHE_SECTORS)),)
+    LOCAL_CFLAGS += -DFATFS_CACHE_SECTORS=$(KERNELFLINGER_FATFS_CACHE_SECTORS)
+endif
+
 ifeq ($(KERNELFLINGER_SUPPORT_USB_STORAGE),true)
 	LOCAL_SRC_FILES += usb_storage.c \
 			   UsbMassBot.c
@@ -177,11 +194,12 @@ ifneq ($(strip $(KERNELFLINGER_USE_UI)),false)
 	upng.c \
 	ui_boot_menu.c \
 	ui_confirm.c
-    LOCAL_GENERATED_SOURCES := \
-        $(foreach file,$(KERNELFLINGER_IMAGES),\
-	    $(res_intermediates)/$(notdir $(file:png=o)))
-
-    LOCAL_GENERATED_SOURCES += $(img_res) $(font_res)
+    LOCAL_GENERATED_SOURCES := $(img_res) $(font_res)
+    ifeq ($(KERNELFLINGER_PREDECODED_IMAGES),false)
+        LOCAL_GENERATED_SOURCES += \
+            $(foreach file,$(KERNELFLINGER_IMAGES),\
+	        $(res_intermediates)/$(notdir $(file:png=o)))
+    endif
 else
     LOCAL_SRC_FILES += \
 	no_ui.c \
@@ -45,6 +45,7 @@
 #include "targets.h"
 #include "gpt.h"
 #include "storage.h"
+#include "storage_io.h"
 #include "text_parser.h"
 #include "watchdog.h"
 #ifdef HAL_AUTODETECT
@@ -53,6 +54,7 @@
 #include "slot.h"
 #include "pae.h"
 #include "timer.h"
+#include "trace.h"
 #include "android_vb2.h"
 #include "acpi.h"
 #ifdef USE_FIRSTSTAGE_MOUNT
@@ -560,6 +562,31 @@ static struct boot_params *get_boot_param_hdr (VOID *bootimage)
     return (struct boot_params *)(bootimage + hdr_size);
 }
 
+/* Set when the ramdisk handed to the kernel lives in the boot or
+   vendor_boot image buffer instead of a dedicated allocation.  */
+static BOOLEAN ramdisk_in_place;
+
+/* The ramdisk can be used in place if it is page aligned, below the
+   kernel ramdisk_max and if the buffer holding it has room for all
+   its parts.  */
+static BOOLEAN ramdisk_fits_in_place(struct boot_params *bp, UINT8 *ramdisk,
+                                     UINT32 rsize, UINTN room)
+{
+        EFI_PHYSICAL_ADDRESS addr = (UINTN)ramdisk;
+
+        return !(addr & EFI_PAGE_MASK) && rsize <= room &&
+                addr + rsize - 1 <= bp->hdr.ramdisk_max;
+}
+
+/* Room available in the partition image buffer allocated by libavb
+   from OFFSET to the end of the buffer.  */
+static UINTN image_room(UINT8 *image, UINT32 offset)
+{
+        UINTN size = uefi_avb_buffer_size(image);
+
+        return size > offset ? size - offset : 0;
+}
+
 static EFI_STATUS setup_ramdisk(UINT8 *bootimage, UINT8 *vendorbootimage, UINT8 *androidcmd)
 {
         struct boot_img_hdr *aosp_header;
@@ -570,6 +597,7 @@ static EFI_STATUS setup_ramdisk(UINT8 *bootimage, UINT8 *vendorbootimage, UINT8
 
         aosp_header = (struct boot_img_hdr *)bootimage;
         bp = get_boot_param_hdr(bootimage);
+        ramdisk_in_place = FALSE;
 
         if (aosp_header->header_version < BOOT_HEADER_V3) {
             roffset = aosp_header->page_size + pagealign(aosp_header,
@@ -582,6 +610,12 @@ static EFI_STATUS setup_ramdisk(UINT8 *bootimage, UINT8 *vendorbootimage, UINT8
 
             bp->hdr.ramdisk_len = rsize;
             debug(L"ramdisk size %d", rsize);
+            if (ramdisk_fits_in_place(bp, bootimage + roffset, rsize, rsize)) {
+                    ramdisk_addr = (UINTN)bootimage + roffset;
+                    ramdisk_in_place = TRUE;
+                    goto done;
+            }
+
             ret = emalloc(rsize, 0x1000, &ramdisk_addr, FALSE);
             if (EFI_ERROR(ret))
                    return ret;
@@ -604,6 +638,21 @@ static EFI_STATUS setup_ramdisk(UINT8 *bootimage, UINT8 *vendorbootimage, UINT8
             }
 
             bp->hdr.ramdisk_len = rsize;
+
+            /* Keep the vendor ramdisk where it has been loaded and
+               append the boot ramdisk to it.  */
+            if (ramdisk_fits_in_place(bp, vendorbootimage + BOOT_IMG_HEADER_SIZE_V3, rsize,
+                                      image_room(vendorbootimage, BOOT_IMG_HEADER_SIZE_V3))) {
+                    ramdisk_addr = (UINTN)vendorbootimage + BOOT_IMG_HEADER_SIZE_V3;
+                    ret = memcpy_s((VOID *)(UINTN)ramdisk_addr + vendor_hdr->vendor_ramdisk_size,
+                                   boot_hdr->ramdisk_size, bootimage + roffset,
+                                   boot_hdr->ramdisk_size);
+                    if (EFI_ERROR(ret))
+                            return ret;
+                    ramdisk_in_place = TRUE;
+                    goto done;
+            }
+
             ret = emalloc(rsize, 0x1000, &ramdisk_addr, FALSE);
             if (EFI_ERROR(ret))
                 return ret;
@@ -653,34 +702,56 @@ static EFI_STATUS setup_ramdisk(UINT8 *bootimage, UINT8 *vendorbootimage, UINT8
             }
 
             bp->hdr.ramdisk_len = rsize;
-            ret = emalloc(rsize, 0x1000, &ramdisk_addr, FALSE);
-            if (EFI_ERROR(ret))
-                return ret;
 
-            if ((UINTN)ramdisk_addr > bp->hdr.ramdisk_max) {
-                error(L"Ramdisk address is too high!");
-                ret = EFI_OUT_OF_RESOURCES;
-                goto out;
-            }
+            /* Keep the vendor ramdisk where it has been loaded and
+               append the boot ramdisk and the bootconfig to it.  The
+               bootconfig is moved first as the boot ramdisk may
+               overwrite it.  */
+            if (ramdisk_fits_in_place(bp, vendorbootimage + vendor_ramdisk_offset, rsize,
+                                      image_room(vendorbootimage, vendor_ramdisk_offset))) {
+                    ramdisk_addr = (UINTN)vendorbootimage + vendor_ramdisk_offset;
+                    if (!memmove_s((VOID *)(UINTN)ramdisk_addr + rboffset,
+                                   rsize - rboffset,
+                                   vendorbootimage + bootconfig_offset,
+                                   vendor_hdr->bootconfig_size))
+                            return EFI_INVALID_PARAMETER;
+
+                    ret = memcpy_s((VOID *)(UINTN)ramdisk_addr + vendor_hdr->vendor_ramdisk_size,
+                                   boot_hdr->ramdisk_size, bootimage + roffset,
+                                   boot_hdr->ramdisk_size);
+                    if (EFI_ERROR(ret))
+                            return ret;
+                    ramdisk_in_place = TRUE;
+            } else {
+                    ret = emalloc(rsize, 0x1000, &ramdisk_addr, FALSE);
+                    if (EFI_ERROR(ret))
+                        return ret;
 
-            ret = memcpy_s((VOID *)(UINTN)ramdisk_addr, rsize,
-                            vendorbootimage + vendor_ramdisk_offset,
-                            vendor_hdr->vendor_ramdisk_size);
-            if (EFI_ERROR(ret))
-                    goto out;
+                    if ((UINTN)ramdisk_addr > bp->hdr.ramdisk_max) {
+                        error(L"Ramdisk address is too high!");
+                        ret = EFI_OUT_OF_RESOURCES;
+                        goto out;
+                    }
 
+                    ret = memcpy_s((VOID *)(UINTN)ramdisk_addr, rsize,
+                                    vendorbootimage + vendor_ramdisk_offset,
+                                    vendor_hdr->vendor_ramdisk_size);
+                    if (EFI_ERROR(ret))
+                            goto out;
 
-            ret = memcpy_s((VOID *)(UINTN)ramdisk_addr + vendor_hdr->vendor_ramdisk_size,
-                            rsize, bootimage + roffset, boot_hdr->ramdisk_size);
-            if (EFI_ERROR(ret))
-                    goto out;
 
+                    ret = memcpy_s((VOID *)(UINTN)ramdisk_addr + vendor_hdr->vendor_ramdisk_size,
+                                    rsize, bootimage + roffset, boot_hdr->ramdisk_size);
+                    if (EFI_ERROR(ret))
+                            goto out;
 
-            ret = memcpy_s((VOID *)(UINTN)ramdisk_addr + rboffset,
-                            rsize, vendorbootimage + bootconfig_offset,
-                            vendor_hdr->bootconfig_size);
-            if (EFI_ERROR(ret))
-                    goto out;
+
+                    ret = memcpy_s((VOID *)(UINTN)ramdisk_addr + rboffset,
+                                    rsize, vendorbootimage + bootconfig_offset,
+                                    vendor_hdr->bootconfig_size);
+                    if (EFI_ERROR(ret))
+                            goto out;
+            }
 
             if (androidcmd != NULL) {
                     int iret;
@@ -700,11 +771,16 @@ static EFI_STATUS setup_ramdisk(UINT8 *bootimage, UINT8 *vendorbootimage, UINT8
             }
         }
 
+done:
+        if (ramdisk_in_place)
+                debug(L"ramdisk used in place at 0x%lx", ramdisk_addr);
         bp->hdr.ramdisk_start = (UINT32)(UINTN)ramdisk_addr;
         return EFI_SUCCESS;
 
 out:
-        efree(ramdisk_addr, rsize);
+        if (!ramdisk_in_place)
+                efree(ramdisk_addr, rsize);
+        ramdisk_in_place = FALSE;
         return ret;
 }
 
@@ -1834,8 +1910,10 @@ static EFI_STATUS handover_kernel(CHAR8 *bootimage, EFI_HANDLE parent_image)
                  */
                 ret = emalloc(init_size, buf->hdr.kernel_alignment, &kernel_start,
                               FALSE);
-                if (EFI_ERROR(ret))
+                if (EFI_ERROR(ret)) {
+                        TRACE_END("kernel_handover");
                         return ret;
+                }
         }
 
         if (aosp_header->header_version < BOOT_HEADER_V3)
@@ -1867,6 +1945,7 @@ static EFI_STATUS handover_kernel(CHAR8 *bootimage, EFI_HANDLE parent_image)
         /* Free UI resources. */
         ui_free();
 
+        log_drain();
         log_flush_to_var(FALSE);
 
         boot_params = (struct boot_params *)(UINTN)boot_addr;
@@ -1887,12 +1966,16 @@ static EFI_STATUS handover_kernel(CHAR8 *bootimage, EFI_HANDLE parent_image)
                 goto out;
         boot_params->hdr.code32_start = (UINT32)((UINT64)kernel_start);
 
+        TRACE_END("kernel_handover");
         ret = handover_jump(parent_image, boot_params, kernel_start);
         /* Shouldn't get here */
         efi_perror(ret, L"handover to Linux kernel has failed");
 
         free_pages(boot_addr, EFI_SIZE_TO_PAGES(16384));
+        goto free_kernel;
 out:
+        TRACE_END("kernel_handover");
+free_kernel:
         efree(kernel_start, ksize);
         return ret;
 }
@@ -1960,8 +2043,7 @@ EFI_STATUS android_image_load_partition(
                 return EFI_OUT_OF_RESOURCES;
 
         debug(L"Reading full boot image (%d bytes)", img_size);
-        ret = uefi_call_wrapper(gpart.dio->ReadDisk, 5, gpart.dio, MediaId, partition_start + vm_offset,
-                                img_size, bootimage);
+        ret = storage_read(&gpart, partition_start + vm_offset, img_size, bootimage);
         if (EFI_ERROR(ret)) {
                 efi_perror(ret, L"ReadDisk");
                 FreePool(bootimage);
@@ -2174,6 +2256,7 @@ EFI_STATUS android_image_start_buffer(
                 return EFI_INVALID_PARAMETER;
         }
 
+        TRACE_BEGIN("kernel_handover");
         debug(L"Creating command line");
         if (is_UEFI())
             parameter = (void *)swap_guid;
@@ -2193,17 +2276,22 @@ EFI_STATUS android_image_start_buffer(
                 efi_perror(ret, L"setup_command_line");
                 if (androidcmd != NULL)
                         FreePool(androidcmd);
+                TRACE_END("kernel_handover");
                 return ret;
         }
 #ifndef DYNAMIC_PARTITIONS
         use_ramdisk = !recovery_in_boot_partition() || boot_target == RECOVERY || boot_target == MEMORY;
 #endif
         if (use_ramdisk) {
+                UINT32 start_ms = boottime_in_msec();
+
                 ret = setup_ramdisk(bootimage, vendorbootimage, androidcmd);
+                debug(L"ramdisk setup time: %u ms", boottime_in_msec() - start_ms);
                 if (EFI_ERROR(ret)) {
                         efi_perror(ret, L"setup_ramdisk");
                         if (androidcmd != NULL)
                                 FreePool(androidcmd);
+                        TRACE_END("kernel_handover");
                         goto out_cmdline;
                 }
         }
@@ -2214,7 +2302,9 @@ EFI_STATUS android_image_start_buffer(
         ret = handover_kernel(bootimage, parent_image);
         efi_perror(ret, L"handover_kernel");
 
-        efree(buf->hdr.ramdisk_start, buf->hdr.ramdisk_len);
+        if (!ramdisk_in_place)
+                efree(buf->hdr.ramdisk_start, buf->hdr.ramdisk_len);
+        ramdisk_in_place = FALSE;
         buf->hdr.ramdisk_start = 0;
         buf->hdr.ramdisk_len = 0;
 out_cmdline:
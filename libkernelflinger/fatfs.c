@@ -55,11 +55,26 @@ VOID debug_hex(UINT32 offset, CHAR8 *data, UINT16 size){
 				d[5], d[6], d[7]);
 	}
 }
-UINT32 fat_getbpb_offset(){
+UINT64 fat_getbpb_offset(){
 	return g_fatsystem.bpb_offset;
 }
 
-EFI_STATUS fat_readdisk(UINT32 offset, UINT32 len, void *data) {
+UINT64 fat_getpart_size(){
+	return g_fatsystem.part_size;
+}
+
+/* Locate the FAT volume of the partition, the offsets given to
+ * fat_readdisk() and fat_writedisk() are 64 bits disk offsets. */
+static void fat_set_partition(FATSYSTEM *fs)
+{
+	UINT32 block_size = fs->parti.bio->Media->BlockSize;
+
+	fs->bpb_offset = fs->parti.part.starting_lba * block_size;
+	fs->part_size = (fs->parti.part.ending_lba - fs->parti.part.starting_lba + 1) *
+		block_size;
+}
+
+EFI_STATUS fat_readdisk(UINT64 offset, UINTN len, void *data) {
 	FATSYSTEM *fs = &g_fatsystem;
 	EFI_STATUS ret = EFI_SUCCESS;
 	if (fs == NULL || fs->parti.dio == NULL || fs->parti.bio == NULL)
@@ -77,7 +92,7 @@ EFI_STATUS fat_readdisk(UINT32 offset, UINT32 len, void *data) {
 	return ret;
 }
 
-EFI_STATUS fat_writedisk( UINT32 offset, UINT32 len, void *data)
+EFI_STATUS fat_writedisk(UINT64 offset, UINTN len, void *data)
 {
 	FATSYSTEM *fs = &g_fatsystem;
 	EFI_STATUS ret = EFI_SUCCESS;
@@ -93,6 +108,42 @@ EFI_STATUS fat_writedisk( UINT32 offset, UINT32 len, void *data)
 }
 
 static TCHAR * fwuImage = L"/FwuImage.bin";
+
+#ifndef FATFS_CLMT_SIZE
+#define FATFS_CLMT_SIZE 64
+#endif
+
+/* Allocate the file as a single block of clusters when its size
+ * changes and enable fast-seek on it: the writes then follow the
+ * cluster link map instead of walking and stretching the chain in the
+ * FAT.  On failure, the file is written the regular way. */
+static void fat_prepare_file(FIL *fp, UINTN size)
+{
+	static DWORD clmt[FATFS_CLMT_SIZE];
+	FRESULT f_ret;
+
+	if (f_size(fp) != size) {
+		f_ret = f_truncate(fp);
+		if (f_ret != FR_OK) {
+			debug(L"f_truncate err:%d", f_ret);
+			return;
+		}
+		f_ret = f_expand(fp, size, 1);
+		if (f_ret != FR_OK) {
+			debug(L"No contiguous space for %s: %d", fwuImage, f_ret);
+			return;
+		}
+	}
+
+	clmt[0] = ARRAY_SIZE(clmt);
+	fp->cltbl = clmt;
+	f_ret = f_lseek(fp, CREATE_LINKMAP);
+	if (f_ret != FR_OK) {
+		debug(L"fast-seek disabled for %s: %d", fwuImage, f_ret);
+		fp->cltbl = NULL;
+	}
+}
+
 EFI_STATUS flash_fwupdate(VOID *data, UINTN size)
 {
 	FATSYSTEM  *fs = &g_fatsystem;
@@ -106,7 +157,7 @@ EFI_STATUS flash_fwupdate(VOID *data, UINTN size)
 		efi_perror(ret, L"Failed to get efi system partition");
 		return ret;
 	}
-	fs->bpb_offset = fs->parti.part.starting_lba*512;
+	fat_set_partition(fs);
 	ret = fat_readdisk(fs->bpb_offset,512,fs->fatfs.win);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to get FAT BPB");
@@ -132,6 +183,7 @@ EFI_STATUS flash_fwupdate(VOID *data, UINTN size)
 		debug(L"f_open err:%d", f_ret);
 		return ret;
 	}
+	fat_prepare_file(&fp, size);
 	ret = f_write(&fp,data,size,&bsize);
 	if(ret != 0) {
 		debug(L"f_write error:%d", ret);
@@ -172,9 +224,9 @@ EFI_STATUS fat_test()
 	}else {
 		error(L"can not find Efi system partition");
 	}
-	fs->bpb_offset = fs->parti.part.starting_lba*512;
-	debug(L"starting_lba is %x",fs->parti.part.starting_lba);
-	debug(L"bpb_offset is %x",fs->bpb_offset);
+	fat_set_partition(fs);
+	debug(L"starting_lba is %lx",fs->parti.part.starting_lba);
+	debug(L"bpb_offset is %lx",fs->bpb_offset);
 	ret = fat_readdisk(fs->bpb_offset,512,fs->fatfs.win);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to get FAT BPB");
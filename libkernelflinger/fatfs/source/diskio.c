@@ -17,6 +17,58 @@
 #define DEV_USB		2	/* Example: Map USB MSD to physical drive 2 */
 #define DEV_NVME    4	/* Example: Map USB MSD to physical drive 2 */
 
+/* Write-back cache of FATFS_CACHE_SECTORS consecutive sectors: small
+   reads load the sectors that follow along, and consecutive small
+   writes are gathered until the cache is full, the volume is synced
+   or another area is accessed. */
+#ifndef FATFS_CACHE_SECTORS
+#define FATFS_CACHE_SECTORS 128
+#endif
+
+static struct {
+	LBA_t start;		/* First cached sector */
+	UINT count;			/* Number of valid sectors from start */
+	UINT dirty_start;	/* Dirty range [dirty_start, dirty_end[, */
+	UINT dirty_end;		/* relative to start */
+	BYTE data[FATFS_CACHE_SECTORS * FF_MAX_SS];
+} cache;
+
+static UINT64 sector_offset (LBA_t sector)
+{
+	return (UINT64)sector * FF_MAX_SS + fat_getbpb_offset();
+}
+
+static DRESULT cache_flush (void)
+{
+	UINT n = cache.dirty_end - cache.dirty_start;
+
+	if (n == 0)
+		return RES_OK;
+
+	if (EFI_ERROR(fat_writedisk(sector_offset(cache.start + cache.dirty_start),
+				    n * FF_MAX_SS, cache.data + cache.dirty_start * FF_MAX_SS)))
+		return RES_ERROR;
+
+	cache.dirty_start = cache.dirty_end = 0;
+	return RES_OK;
+}
+
+static void cache_invalidate (void)
+{
+	cache.count = cache.dirty_start = cache.dirty_end = 0;
+}
+
+static int out_of_partition (LBA_t sector, UINT count)
+{
+	return (UINT64)sector + count > fat_getpart_size() / FF_MAX_SS;
+}
+
+static int cache_overlaps (LBA_t sector, UINT count)
+{
+	return cache.count && sector < cache.start + cache.count &&
+		sector + count > cache.start;
+}
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -47,6 +99,8 @@ DSTATUS disk_initialize (
 {
 	switch (pdrv) {	
 		case DEV_NVME:
+			/* The volume may have changed since the last mount */
+			cache_invalidate();
 			return 0x0;
 		default:
 			return STA_NODISK;
@@ -67,20 +121,45 @@ DRESULT disk_read (
 		UINT count		/* Number of sectors to read */
 		)
 {
-	DRESULT ret = RES_OK;
-	UINT32 offset = 0;
-	offset += sector;
-	offset = offset * 512;
-	offset += fat_getbpb_offset();
-	switch (pdrv) {
-		case DEV_NVME:
-			fat_readdisk(offset,count*512,buff);
-			return ret;
-		default:
-			return ret;
+	UINT64 remaining;
+
+	if (pdrv != DEV_NVME || out_of_partition(sector, count))
+		return RES_PARERR;
+
+	if (cache.count && sector >= cache.start &&
+	    sector + count <= cache.start + cache.count) {
+		memcpy(buff, cache.data + (sector - cache.start) * FF_MAX_SS,
+		       count * FF_MAX_SS);
+		return RES_OK;
 	}
 
-	return RES_PARERR;
+	if (count >= FATFS_CACHE_SECTORS) {
+		if (cache_overlaps(sector, count) && cache_flush() != RES_OK)
+			return RES_ERROR;
+		if (EFI_ERROR(fat_readdisk(sector_offset(sector), count * FF_MAX_SS, buff)))
+			return RES_ERROR;
+		return RES_OK;
+	}
+
+	/* Load the cache from this sector on, up to the end of the
+	   partition */
+	if (cache_flush() != RES_OK)
+		return RES_ERROR;
+	cache_invalidate();
+
+	remaining = fat_getpart_size() / FF_MAX_SS - sector;
+	cache.start = sector;
+	cache.count = remaining < FATFS_CACHE_SECTORS ? remaining : FATFS_CACHE_SECTORS;
+	if (cache.count < count)
+		cache.count = count;
+	if (EFI_ERROR(fat_readdisk(sector_offset(sector), cache.count * FF_MAX_SS,
+				   cache.data))) {
+		cache_invalidate();
+		return RES_ERROR;
+	}
+
+	memcpy(buff, cache.data, count * FF_MAX_SS);
+	return RES_OK;
 }
 
 
@@ -98,21 +177,50 @@ DRESULT disk_write (
 		UINT count			/* Number of sectors to write */
 		)
 {
-	UINT32 offset = 0;
-	offset += sector;
-	offset = offset * 512;
-	offset += fat_getbpb_offset();
+	UINT rel;
+
+	if (pdrv != DEV_NVME || out_of_partition(sector, count))
+		return RES_PARERR;
+
+	if (count >= FATFS_CACHE_SECTORS) {
+		if (cache_overlaps(sector, count)) {
+			if (cache_flush() != RES_OK)
+				return RES_ERROR;
+			cache_invalidate();
+		}
+		if (EFI_ERROR(fat_writedisk(sector_offset(sector), count * FF_MAX_SS,
+					    (void *)buff)))
+			return RES_ERROR;
+		return RES_OK;
+	}
 
-	switch (pdrv) {
-		case DEV_NVME:
-			fat_writedisk(offset,count*512,(void *)buff);
-			return 0x0;
-		default:
-			return RES_PARERR;
+	/* Start over unless the sectors extend or overwrite the cached
+	   ones and fit in the cache */
+	if (!cache.count || sector < cache.start ||
+	    sector > cache.start + cache.count ||
+	    sector + count > cache.start + FATFS_CACHE_SECTORS) {
+		if (cache_flush() != RES_OK)
+			return RES_ERROR;
+		cache_invalidate();
+		cache.start = sector;
 	}
 
+	rel = sector - cache.start;
+	memcpy(cache.data + rel * FF_MAX_SS, buff, count * FF_MAX_SS);
+	if (rel + count > cache.count)
+		cache.count = rel + count;
+
+	if (cache.dirty_start == cache.dirty_end) {
+		cache.dirty_start = rel;
+		cache.dirty_end = rel + count;
+	} else {
+		if (rel < cache.dirty_start)
+			cache.dirty_start = rel;
+		if (rel + count > cache.dirty_end)
+			cache.dirty_end = rel + count;
+	}
 
-	return RES_PARERR;
+	return RES_OK;
 }
 
 #endif
@@ -129,6 +237,10 @@ DRESULT disk_ioctl (
 		)
 {
 	DRESULT ret = RES_OK;
+
+	if (pdrv == DEV_NVME && cmd == CTRL_SYNC)
+		return cache_flush();
+
 	/* just make sure pass compile*/
 	if (cmd != 0 || buff == NULL) {
 		return ret;
@@ -39,7 +39,9 @@
 #include "gpt.h"
 #include "gpt_bin.h"
 #include "storage.h"
+#include "storage_io.h"
 #include "pci.h"
+#include "trace.h"
 
 #define PROTECTIVE_MBR 0xEE
 
@@ -79,6 +81,17 @@ struct mbr {
 } __attribute__((__packed__));
 
 #define GPT_REVISION 0x00010000
+
+/* Open addressing hash tables of the partition entries, indexed by
+   label and by unique GUID.  A slot holds the entry index plus one,
+   zero meaning the slot is empty.  */
+#define GPT_INDEX_SIZE (2 * GPT_ENTRIES)
+struct gpt_index {
+	BOOLEAN valid;
+	UINT16 label[GPT_INDEX_SIZE];
+	UINT16 uuid[GPT_INDEX_SIZE];
+};
+
 struct gpt_disk {
 	EFI_BLOCK_IO *bio;
 	EFI_DISK_IO *dio;
@@ -89,6 +102,7 @@ struct gpt_disk {
 	logical_unit_t log_unit;
 	struct gpt_header gpt_hd;
 	struct gpt_partition partitions[GPT_ENTRIES];
+	struct gpt_index index;
 };
 
 /* Allow to scan and flash only one disk at a time
@@ -98,6 +112,16 @@ struct gpt_disk *pdisk = &sdisk;
 static struct gpt_disk vm_disk;
 uint64_t vm_offset = 0;
 
+/* Incremented each time the cached partition entries change, see
+   gpt_get_generation().  */
+static UINT32 generation;
+
+static void gpt_invalidate(struct gpt_disk *disk)
+{
+	disk->index.valid = FALSE;
+	generation++;
+}
+
 static EFI_STATUS calculate_crc32(void *data, UINTN size, UINT32 *crc)
 {
 	EFI_STATUS ret;
@@ -233,6 +257,8 @@ static EFI_STATUS gpt_list_partition_on_disk(struct gpt_disk *disk)
 {
 	EFI_STATUS ret;
 
+	gpt_invalidate(disk);
+
 	if (!is_gpt_device(&disk->gpt_hd))
 		return EFI_NOT_FOUND;
 
@@ -269,9 +295,11 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 	if (sdisk.dio && sdisk.log_unit == log_unit)
 		return EFI_SUCCESS;
 
+	TRACE_BEGIN("gpt_load");
 	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &BlockIoProtocol, NULL, &nb_handle, &handles);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to locate Block IO Protocol");
+		TRACE_END("gpt_load");
 		return ret;
 	}
 	debug(L"Found %d block io protocols", nb_handle);
@@ -307,12 +335,19 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 	ret = EFI_SUCCESS;
 free_handles:
 	FreePool(handles);
+	TRACE_END("gpt_load");
 	return ret;
 }
 
 void gpt_free_cache(void)
 {
 	ZeroMem(&sdisk, sizeof(sdisk));
+	generation++;
+}
+
+UINT32 gpt_get_generation(void)
+{
+	return generation;
 }
 
 EFI_STATUS gpt_sync(void)
@@ -368,6 +403,7 @@ EFI_STATUS gpt_get_root_disk(struct gpt_partition_interface *gpart, logical_unit
 	gpart->part.ending_lba = pdisk->bio->Media->LastBlock;
 	gpart->bio = pdisk->bio;
 	gpart->dio = pdisk->dio;
+	gpart->handle = pdisk->handle;
 
 	return EFI_SUCCESS;
 }
@@ -381,69 +417,149 @@ EFI_STATUS gpt_get_root_disk(struct gpt_partition_interface *gpart, logical_unit
 
 static const CHAR16 ANDROID_PREFIX[] = L"android_";
 
-static CHAR16 *make_android_label(const CHAR16 *label)
+static const UINTN ANDROID_PREFIX_LEN = ARRAY_SIZE(ANDROID_PREFIX) - 1;
+
+static BOOLEAN has_android_prefix(const CHAR16 *label)
 {
-	EFI_STATUS ret;
-	static CHAR16 android_label[GPT_NAME_LEN];
-	static CHAR16 *suffix = &android_label[ARRAY_SIZE(ANDROID_PREFIX) - 1];
-	UINTN label_size = StrLen(label) * sizeof(CHAR16);
+	return !memcmp(label, ANDROID_PREFIX,
+		       ANDROID_PREFIX_LEN * sizeof(CHAR16));
+}
 
-	if (!*android_label) {
-		ret = memcpy_s(android_label, sizeof(android_label), ANDROID_PREFIX, sizeof(ANDROID_PREFIX));
-		if (EFI_ERROR(ret))
-			return NULL;
-	}
+/* FNV-1a hash of a partition label.  */
+static UINTN hash_label(const CHAR16 *label, UINTN max_len)
+{
+	UINT32 hash = 2166136261;
+	UINTN i;
 
-	if (label_size + sizeof(ANDROID_PREFIX) > sizeof(android_label))
-		return NULL;
+	for (i = 0; i < max_len && label[i]; i++)
+		hash = (hash ^ label[i]) * 16777619;
 
-	ret = memcpy_s(suffix, label_size + sizeof(CHAR16), label, label_size + sizeof(CHAR16));
-	return (ret == EFI_SUCCESS) ? (android_label) : (NULL);
+	return hash % GPT_INDEX_SIZE;
 }
 
-static struct gpt_partition *gpt_find_partition(const CHAR16 *label)
+/* The partitions are indexed by label without the "android_" prefix
+   so that a LABEL lookup finds both the LABEL and the "android_"
+   LABEL partitions in the same bucket.  */
+static UINTN hash_part_label(struct gpt_partition *part)
 {
-	UINTN p;
-	CHAR16 *android_label;
+	if (has_android_prefix(part->name))
+		return hash_label(&part->name[ANDROID_PREFIX_LEN],
+				  GPT_NAME_LEN - ANDROID_PREFIX_LEN);
 
-	android_label = make_android_label(label);
+	return hash_label(part->name, GPT_NAME_LEN);
+}
 
-	for (p = 0; p < pdisk->gpt_hd.number_of_entries; p++) {
-		struct gpt_partition *part;
+static UINTN hash_uuid(EFI_GUID *uuid)
+{
+	UINT32 hash = 2166136261;
+	UINT8 *b = (UINT8 *)uuid;
+	UINTN i;
 
-		part = &pdisk->partitions[p];
+	for (i = 0; i < sizeof(*uuid); i++)
+		hash = (hash ^ b[i]) * 16777619;
+
+	return hash % GPT_INDEX_SIZE;
+}
+
+static void index_insert(UINT16 *table, UINTN hash, UINTN entry)
+{
+	while (table[hash])
+		hash = (hash + 1) % GPT_INDEX_SIZE;
+	table[hash] = entry + 1;
+}
+
+/* Build the label and unique GUID indexes of the partition entries
+   on the first lookup.  They are invalidated each time the partition
+   entries are read from the disk or modified.  */
+static struct gpt_index *gpt_get_index(struct gpt_disk *disk)
+{
+	struct gpt_index *index = &disk->index;
+	struct gpt_partition *part;
+	UINTN p;
+
+	if (index->valid)
+		return index;
+
+	ZeroMem(index, sizeof(*index));
+	for (p = 0; p < disk->gpt_hd.number_of_entries && p < GPT_ENTRIES; p++) {
+		part = &disk->partitions[p];
+		index_insert(index->uuid, hash_uuid(&part->unique), p);
 		if (!CompareGuid(&part->type, &NullGuid))
 			continue;
+		index_insert(index->label, hash_part_label(part), p);
+	}
+	index->valid = TRUE;
 
-		if (StrCmp(part->name, label) &&
-		    (!android_label || StrCmp(part->name, android_label))) {
-			continue;
-		}
+	return index;
+}
 
-		debug(L"Found label %s in partition %d", label, p);
-		return part;
+static BOOLEAN label_match(struct gpt_partition *part, const CHAR16 *label)
+{
+	if (!StrCmp(part->name, label))
+		return TRUE;
+
+	return has_android_prefix(part->name) &&
+		!StrCmp(&part->name[ANDROID_PREFIX_LEN], label);
+}
+
+/* Return the smallest matching entry index of the HASH bucket or
+   FOUND if it is smaller.  */
+static UINTN index_lookup_label(struct gpt_index *index, UINTN hash,
+				const CHAR16 *label, UINTN found)
+{
+	UINTN p;
+
+	for (; index->label[hash]; hash = (hash + 1) % GPT_INDEX_SIZE) {
+		p = index->label[hash] - 1;
+		if (p < found && label_match(&pdisk->partitions[p], label))
+			found = p;
 	}
 
-	return NULL;
+	return found;
 }
 
-static struct gpt_partition *gpt_find_partition_by_uuid(EFI_GUID * uuid)
+static struct gpt_partition *gpt_find_partition(const CHAR16 *label)
 {
+	struct gpt_index *index;
 	UINTN p;
 
-	for (p = 0; p < sdisk.gpt_hd.number_of_entries; p++) {
-		struct gpt_partition *part;
+	index = gpt_get_index(pdisk);
 
-		part = &sdisk.partitions[p];
-		if (CompareGuid(&part->unique, uuid))
-			continue;
+	p = index_lookup_label(index, hash_label(label, GPT_NAME_LEN),
+			       label, GPT_ENTRIES);
+	/* An "android_" LABEL partition is also indexed as LABEL.  */
+	if (has_android_prefix(label))
+		p = index_lookup_label(index,
+				       hash_label(&label[ANDROID_PREFIX_LEN],
+						  GPT_NAME_LEN - ANDROID_PREFIX_LEN),
+				       label, p);
+
+	if (p == GPT_ENTRIES)
+		return NULL;
 
+	debug(L"Found label %s in partition %d", label, p);
+	return &pdisk->partitions[p];
+}
+
+static struct gpt_partition *gpt_find_partition_by_uuid(EFI_GUID * uuid)
+{
+	struct gpt_index *index;
+	UINTN p, hash, found = GPT_ENTRIES;
 
-		debug(L"Found partition %d", p);
-		return part;
+	index = gpt_get_index(&sdisk);
+
+	for (hash = hash_uuid(uuid); index->uuid[hash];
+	     hash = (hash + 1) % GPT_INDEX_SIZE) {
+		p = index->uuid[hash] - 1;
+		if (p < found && !CompareGuid(&sdisk.partitions[p].unique, uuid))
+			found = p;
 	}
 
-	return NULL;
+	if (found == GPT_ENTRIES)
+		return NULL;
+
+	debug(L"Found partition %d", found);
+	return &sdisk.partitions[found];
 }
 
 
@@ -789,6 +905,7 @@ static EFI_STATUS gpt_write_partition_tables(void)
 	struct gpt_header *gh_backup;
 	UINT32 crc;
 
+	gpt_invalidate(pdisk);
 	gh = &pdisk->gpt_hd;
 
 	entries_size = (UINT64)gh->number_of_entries * gh->size_of_entry;
@@ -859,6 +976,7 @@ EFI_STATUS gpt_create(struct gpt_header *gh, UINTN gh_size,
 	if (EFI_ERROR(ret))
 		return ret;
 
+	gpt_invalidate(pdisk);
 	if (gh) {
 		if (CompareMem(gh->signature, EFI_PTAB_HEADER_ID, sizeof(gh->signature)) ||
 		    gh_size != GPT_HEADER_SIZE + sizeof(pdisk->partitions))
@@ -1113,8 +1231,7 @@ EFI_STATUS read_partition(struct gpt_partition_interface *gparti, INT64 offset,
 		return EFI_END_OF_MEDIA;
 	}
 
-	ret = gparti->dio->ReadDisk(gparti->dio, gparti->bio->Media->MediaId,
-		partoffset + offset, len, data);
+	ret = storage_read(gparti, partoffset + offset, len, data);
 	if (EFI_ERROR(ret))
 		efi_perror(ret, L"read partition %s failed", gparti->part.name);
 
@@ -1139,6 +1256,7 @@ void set_hard_disk()
 {
 	vm_offset = 0;
 	pdisk = &sdisk;
+	generation++;
 	part_select(0);
 }
 
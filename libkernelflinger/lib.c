@@ -1346,6 +1346,7 @@ VOID reboot(CHAR16 *target, EFI_RESET_TYPE type)
                 }
         }
 
+        log_drain();
         uefi_call_wrapper(RT->ResetSystem, 4, type, EFI_SUCCESS,
                           0, target);
         error(L"Failed to reboot the device ... looping forever");
@@ -1588,6 +1589,8 @@ UINT64 efi_time_to_ctime(EFI_TIME *time)
                 (UINT64)time->Second;
 }
 
+/* %ebx may be the PIC register, it is swapped with an early-clobber
+   output around cpuid.  The sub-leaf is 0.  */
 VOID cpuid(UINT32 op, UINT32 reg[4])
 {
 #if __LP64__
@@ -1595,15 +1598,13 @@ VOID cpuid(UINT32 op, UINT32 reg[4])
                      "cpuid\n\t"
                      "xchg{q}\t{%%}rbx, %q1\n\t"
                      : "=a" (reg[0]), "=&r" (reg[1]), "=c" (reg[2]), "=d" (reg[3])
-                     : "a" (op));
+                     : "a" (op), "c" (0));
 #else
-        asm volatile("pushl %%ebx      \n\t" /* save %ebx */
-                     "cpuid            \n\t"
-                     "movl %%ebx, %1   \n\t" /* save what cpuid just put in %ebx */
-                     "popl %%ebx       \n\t" /* restore the old %ebx */
-                     : "=a"(reg[0]), "=r"(reg[1]), "=c"(reg[2]), "=d"(reg[3])
-                     : "a"(op)
-                     : "cc");
+        asm volatile("xchg{l}\t{%%}ebx, %k1\n\t"
+                     "cpuid\n\t"
+                     "xchg{l}\t{%%}ebx, %k1\n\t"
+                     : "=a" (reg[0]), "=&r" (reg[1]), "=c" (reg[2]), "=d" (reg[3])
+                     : "a" (op), "c" (0));
 #endif
 }
 
@@ -36,6 +36,7 @@
 #include "log.h"
 #include "lib.h"
 #include "vars.h"
+#include "timer.h"
 
 static SERIAL_IO_INTERFACE *serial;
 
@@ -50,16 +51,33 @@ static SERIAL_IO_INTERFACE *serial;
 static CHAR16 buf16[BUFFER_SIZE];
 static CHAR8 buf8[BUFFER_SIZE];
 
+/* LOG_BUF is a ring buffer.  LOG_HEAD is the total number of bytes
+ * written into it and SERIAL_TAIL the total number of bytes already
+ * sent to the serial port.  */
 #define LOG_BUF_SIZE 4096
 static CHAR8 log_buf[LOG_BUF_SIZE];
-static UINTN pos, last_pos;
+static UINT64 log_head, serial_tail;
+
+/* In deferred mode, the messages are only written to LOG_BUF and
+ * sent to the serial port by log_drain().  */
+#ifdef LOG_DEFERRED
+static BOOLEAN deferred = TRUE;
+#else
+static BOOLEAN deferred = FALSE;
+#endif
+static BOOLEAN at_line_start = TRUE;
+static UINT64 dropped, dropped_reported;
+
+/* TSC frequency used to timestamp the deferred messages, read once
+ * from CPUID by serial_init().  0 if unknown.  */
+static UINT32 tsc_mhz;
 
 EFI_STATUS log_flush_to_var(BOOLEAN nonvol)
 {
 	static volatile BOOLEAN running;
 	EFI_STATUS ret;
-	CHAR8 *buf, *cur;
-	UINTN size;
+	CHAR8 *buf;
+	UINTN size, start;
 
 	if (running)
 		return EFI_ALREADY_STARTED;
@@ -74,32 +92,33 @@ EFI_STATUS log_flush_to_var(BOOLEAN nonvol)
 		return EFI_SUCCESS;
 #endif
 
-	if (last_pos) {		/* Manage roll-over */
-		size = last_pos < pos ? pos : last_pos;
+	if (log_head > LOG_BUF_SIZE) {	/* Manage roll-over */
+		size = LOG_BUF_SIZE;
+		start = log_head % LOG_BUF_SIZE;
 
-		cur = buf = AllocatePool(size);
+		buf = AllocatePool(size);
 		if (!buf) {
 			ret = EFI_OUT_OF_RESOURCES;
 			goto out;
 		}
 
-		if (pos < last_pos) {
-			ret = memcpy_s(buf, size, log_buf + pos, last_pos - pos);
+		ret = memcpy_s(buf, size, log_buf + start, size - start);
+		if (EFI_ERROR(ret))
+			goto free;
+		if (start) {
+			ret = memcpy_s(buf + size - start, start, log_buf, start);
 			if (EFI_ERROR(ret))
-				goto out;
-			cur += last_pos - pos;
+				goto free;
 		}
-		ret = memcpy_s(cur, size, log_buf, pos);
-		if (EFI_ERROR(ret))
-			goto out;
 	} else {
-		size = pos;
+		size = log_head;
 		buf = log_buf;
 	}
 
 	ret = set_efi_variable(&loader_guid, LOG_VAR,
 			       size, buf, nonvol, TRUE);
-	if (last_pos)
+free:
+	if (buf != log_buf)
 		FreePool(buf);
 
 out:
@@ -110,26 +129,94 @@ out:
 static void log_append_to_buffer(CHAR8 *msg, UINTN length)
 {
 	EFI_STATUS ret;
+	UINTN start, n;
 
-	if (length > LOG_BUF_SIZE)
+	if (length == 0 || length > LOG_BUF_SIZE)
 		return;
 
-	if (pos + length >= LOG_BUF_SIZE) {
-		last_pos = pos;
-		pos = 0;
+	/* memcpy_s() logs zero-length copies, which would recurse
+	 * here: only copy the wrapped tail when there is one.  */
+	start = log_head % LOG_BUF_SIZE;
+	n = min(length, LOG_BUF_SIZE - start);
+	ret = memcpy_s(log_buf + start, sizeof(log_buf) - start, msg, n);
+	if (EFI_ERROR(ret))
+		return;
+	if (length > n) {
+		ret = memcpy_s(log_buf, sizeof(log_buf), msg + n, length - n);
+		if (EFI_ERROR(ret))
+			return;
 	}
 
-	ret = memcpy_s(log_buf + pos, sizeof(log_buf) - pos, msg, length);
-	if (EFI_ERROR(ret))
+	log_head += length;
+
+	/* The oldest bytes not sent yet have been overwritten.  */
+	if (log_head - serial_tail > LOG_BUF_SIZE) {
+		dropped += log_head - LOG_BUF_SIZE - serial_tail;
+		serial_tail = log_head - LOG_BUF_SIZE;
+	}
+}
+
+static EFI_STATUS serial_write(CHAR8 *data, UINTN length)
+{
+	EFI_STATUS ret;
+	UINTN size;
+
+	while (length) {
+		size = length;
+		ret = uefi_call_wrapper(serial->Write, 3, serial, &size, data);
+		if (EFI_ERROR(ret))
+			return ret;
+		if (!size)
+			return EFI_TIMEOUT;
+		data += size;
+		length -= size;
+	}
+
+	return EFI_SUCCESS;
+}
+
+void log_drain(void)
+{
+	static volatile BOOLEAN running;
+	CHAR8 msg[48];
+	UINTN start, length;
+	int len;
+
+	if (!serial || running)
 		return;
 
-	pos += length;
+	running = TRUE;
+
+	if (dropped != dropped_reported) {
+		len = efi_snprintf(msg, sizeof(msg),
+				   (CHAR8 *)"[%ld log bytes dropped]\n",
+				   dropped - dropped_reported);
+		if (len > 0)
+			serial_write(msg, len);
+		dropped_reported = dropped;
+	}
+
+	while (serial_tail < log_head) {
+		start = serial_tail % LOG_BUF_SIZE;
+		length = min(log_head - serial_tail, (UINT64)LOG_BUF_SIZE - start);
+		if (EFI_ERROR(serial_write(log_buf + start, length)))
+			break;
+		serial_tail += length;
+	}
+
+	running = FALSE;
+}
+
+UINT64 log_get_dropped(void)
+{
+	return dropped;
 }
 
 static EFI_STATUS serial_init()
 {
 	EFI_STATUS ret;
 	EFI_GUID guid = SERIAL_IO_PROTOCOL;
+	UINT8 value;
 
 	ret = LibLocateProtocol(&guid, (void **)&serial);
 	if (EFI_ERROR(ret))
@@ -146,27 +233,54 @@ static EFI_STATUS serial_init()
 	if (EFI_ERROR(ret))
 		return ret;
 
+	ret = get_efi_variable_byte(&loader_guid, LOG_DEFERRED_VAR, &value);
+	if (!EFI_ERROR(ret))
+		deferred = value != 0;
+
+	if (deferred)
+		tsc_mhz = get_tsc_mhz();
+
 	return EFI_SUCCESS;
 }
 
 void vlog(const CHAR16 *fmt, va_list args)
 {
-	UINTN length;
+	UINTN length = 0;
+	UINT32 ms = 0;
 
 	if (!serial && EFI_ERROR(serial_init()))
 		return;
 
-	length = VSPrint(buf16, sizeof(buf16), (CHAR16 *)fmt, args) + 1;
+	/* Timestamp the messages as they are sent later.  */
+	if (deferred && at_line_start) {
+		if (tsc_mhz)
+			ms = rdtsc() / tsc_mhz / 1000;
+		length = SPrint(buf16, sizeof(buf16), L"[%d.%03d] ",
+				ms / 1000, ms % 1000);
+	}
+
+	length += VSPrint(buf16 + length, sizeof(buf16) - length * sizeof(CHAR16),
+			  (CHAR16 *)fmt, args) + 1;
 
 	if (EFI_ERROR(str_to_stra(buf8, buf16, length)))
 		return;
 
 	/* Drop the NUL termination character */
 	length--;
+	if (length)
+		at_line_start = buf8[length - 1] == '\n';
+
+	if (deferred) {
+		log_append_to_buffer(buf8, length);
+		return;
+	}
+
+	log_drain();
 	if (EFI_ERROR(uefi_call_wrapper(serial->Write, 3, serial, &length, buf8)))
 		return;
 
 	log_append_to_buffer(buf8, length);
+	serial_tail = log_head;
 }
 
 void log(const CHAR16 *fmt, ...)
@@ -33,6 +33,7 @@
 #include <log.h>
 #include <lib.h>
 #include "storage.h"
+#include "storage_io.h"
 #include "gpt.h"
 #include "pci.h"
 #include "protocol/EraseBlock.h"
@@ -338,13 +339,72 @@ EFI_STATUS storage_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, EFI_LBA st
 	return cur_storage->erase_blocks(handle, bio, start, end);
 }
 
+/* Return the handle the BIO instance is installed on.  */
+static EFI_HANDLE get_block_io_handle(EFI_BLOCK_IO *bio)
+{
+	EFI_HANDLE *handles, found = NULL;
+	EFI_BLOCK_IO *cur;
+	UINTN nb_handle, i;
+	EFI_STATUS ret;
+
+	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				&BlockIoProtocol, NULL, &nb_handle, &handles);
+	if (EFI_ERROR(ret))
+		return NULL;
+
+	for (i = 0; i < nb_handle; i++) {
+		ret = uefi_call_wrapper(BS->HandleProtocol, 3, handles[i],
+					&BlockIoProtocol, (VOID **)&cur);
+		if (!EFI_ERROR(ret) && cur == bio) {
+			found = handles[i];
+			break;
+		}
+	}
+
+	FreePool(handles);
+	return found;
+}
+
+/* Open an asynchronous I/O queue on the disk BIO belongs to.  Return
+ * NULL if the firmware does not provide EFI_DISK_IO2_PROTOCOL on this
+ * disk, in which case the caller writes synchronously.  */
+static struct storage_io *open_fill_queue(EFI_BLOCK_IO *bio)
+{
+	struct gpt_partition_interface gparti = { .bio = bio };
+	struct storage_io *io;
+	EFI_STATUS ret;
+
+	gparti.handle = get_block_io_handle(bio);
+	if (!gparti.handle)
+		return NULL;
+
+	ret = uefi_call_wrapper(BS->HandleProtocol, 3, gparti.handle,
+				&DiskIoProtocol, (VOID **)&gparti.dio);
+	if (EFI_ERROR(ret))
+		return NULL;
+
+	ret = storage_io_open(&gparti, &io);
+	if (EFI_ERROR(ret))
+		return NULL;
+
+	if (!storage_io_is_async(io)) {
+		storage_io_close(io);
+		return NULL;
+	}
+
+	return io;
+}
+
+/* The PATTERN buffer is only read, so the same buffer is used by all
+ * the requests in flight.  */
 EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 			    VOID *pattern, UINTN pattern_blocks)
 {
+	struct storage_io *io;
 	EFI_LBA lba;
 	UINT64 size;
 	uint32_t total, print_sec, print_prev;
-	EFI_STATUS ret;
+	EFI_STATUS ret = EFI_SUCCESS, close_ret;
 
 	debug(L"Fill lba %d -> %d", start, end);
 	if (end <= start)
@@ -353,6 +413,8 @@ EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 	if (bio->Media->BlockSize == 0)
 		return EFI_INVALID_PARAMETER;
 
+	io = open_fill_queue(bio);
+
 	total = end - start +1;
 	info_n(L"Erasing ");
 	print_sec = boottime_in_msec() / 1000;
@@ -363,16 +425,31 @@ EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 		else
 			size = pattern_blocks;
 
-		ret = uefi_call_wrapper(bio->WriteBlocks, 5, bio, bio->Media->MediaId,
-				vm_offset / bio->Media->BlockSize + lba,
-				bio->Media->BlockSize * size, pattern);
+		if (io)
+			ret = storage_io_write(io, (vm_offset / bio->Media->BlockSize + lba) * bio->Media->BlockSize,
+					       bio->Media->BlockSize * size, pattern);
+		else
+			ret = uefi_call_wrapper(bio->WriteBlocks, 5, bio, bio->Media->MediaId,
+					vm_offset / bio->Media->BlockSize + lba,
+					bio->Media->BlockSize * size, pattern);
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Failed to erase block %ld", lba);
-			return ret;
+			break;
 		}
 
 		print_progress(lba + size - start, total, boottime_in_msec() / 1000, &print_sec, &print_prev);
 	}
+
+	if (io) {
+		close_ret = storage_io_close(io);
+		if (EFI_ERROR(close_ret) && !EFI_ERROR(ret)) {
+			efi_perror(close_ret, L"Failed to erase blocks %ld -> %ld", start, end);
+			ret = close_ret;
+		}
+	}
+	if (EFI_ERROR(ret))
+		return ret;
+
 	print_progress(total, total, boottime_in_msec() / 1000, &print_sec, &print_prev);
 	info_n(L"\n");
 
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2024, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <log.h>
+#include <lib.h>
+#include "storage_io.h"
+#include "protocol/DiskIo2.h"
+
+struct storage_io {
+	EFI_DISK_IO *dio;
+	EFI_DISK_IO2_PROTOCOL *dio2;
+	UINT32 media_id;
+	EFI_DISK_IO2_TOKEN token[STORAGE_IO_DEPTH];
+	UINTN head;		/* Oldest request in flight */
+	UINTN count;		/* Number of requests in flight */
+	EFI_STATUS status;	/* First error */
+};
+
+static EFI_GUID DiskIo2Protocol = EFI_DISK_IO2_PROTOCOL_GUID;
+
+static void close_events(struct storage_io *io)
+{
+	UINTN i;
+
+	for (i = 0; i < STORAGE_IO_DEPTH; i++) {
+		if (!io->token[i].Event)
+			continue;
+		uefi_call_wrapper(BS->CloseEvent, 1, io->token[i].Event);
+		io->token[i].Event = NULL;
+	}
+}
+
+/* EFI_DISK_IO2_PROTOCOL is only used if it sits on the same handle as
+ * the EFI_DISK_IO_PROTOCOL instance GPARTI is using, so that both
+ * interpret offsets the same way.  */
+static EFI_DISK_IO2_PROTOCOL *get_disk_io2(struct gpt_partition_interface *gparti)
+{
+	EFI_DISK_IO2_PROTOCOL *dio2;
+	EFI_DISK_IO *dio;
+	EFI_STATUS ret;
+
+	if (!gparti->handle)
+		return NULL;
+
+	ret = uefi_call_wrapper(BS->HandleProtocol, 3, gparti->handle,
+				&DiskIoProtocol, (VOID **)&dio);
+	if (EFI_ERROR(ret) || dio != gparti->dio)
+		return NULL;
+
+	ret = uefi_call_wrapper(BS->HandleProtocol, 3, gparti->handle,
+				&DiskIo2Protocol, (VOID **)&dio2);
+	if (EFI_ERROR(ret))
+		return NULL;
+
+	return dio2;
+}
+
+EFI_STATUS storage_io_open(struct gpt_partition_interface *gparti,
+			   struct storage_io **io_p)
+{
+	struct storage_io *io;
+	EFI_STATUS ret;
+	UINTN i;
+
+	if (!gparti || !io_p)
+		return EFI_INVALID_PARAMETER;
+
+	io = AllocateZeroPool(sizeof(*io));
+	if (!io)
+		return EFI_OUT_OF_RESOURCES;
+
+	io->dio = gparti->dio;
+	io->media_id = gparti->bio->Media->MediaId;
+	io->status = EFI_SUCCESS;
+	io->dio2 = get_disk_io2(gparti);
+
+	for (i = 0; io->dio2 && i < STORAGE_IO_DEPTH; i++) {
+		ret = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL,
+					&io->token[i].Event);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to create storage I/O event, using synchronous I/O");
+			close_events(io);
+			io->dio2 = NULL;
+		}
+	}
+
+	*io_p = io;
+	return EFI_SUCCESS;
+}
+
+BOOLEAN storage_io_is_async(struct storage_io *io)
+{
+	return io->dio2 != NULL;
+}
+
+static EFI_STATUS storage_io_submit(struct storage_io *io, BOOLEAN write,
+				   UINT64 offset, UINTN size, VOID *buf)
+{
+	EFI_DISK_IO2_TOKEN *token;
+	EFI_STATUS ret;
+
+	if (io->count == STORAGE_IO_DEPTH) {
+		ret = storage_io_wait(io);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	if (EFI_ERROR(io->status))
+		return io->status;
+
+	token = &io->token[(io->head + io->count) % STORAGE_IO_DEPTH];
+	token->TransactionStatus = EFI_SUCCESS;
+
+	if (!io->dio2)
+		ret = uefi_call_wrapper((write ? io->dio->WriteDisk : io->dio->ReadDisk),
+					5, io->dio, io->media_id, offset, size, buf);
+	else
+		ret = uefi_call_wrapper((write ? io->dio2->WriteDiskEx : io->dio2->ReadDiskEx),
+					6, io->dio2, io->media_id, offset, token, size, buf);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to %a %d bytes at offset 0x%lx",
+			   write ? "write" : "read", size, offset);
+		io->status = ret;
+		return ret;
+	}
+
+	if (io->dio2)
+		io->count++;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS storage_io_read(struct storage_io *io, UINT64 offset,
+			   UINTN size, VOID *buf)
+{
+	return storage_io_submit(io, FALSE, offset, size, buf);
+}
+
+EFI_STATUS storage_io_write(struct storage_io *io, UINT64 offset,
+			    UINTN size, VOID *buf)
+{
+	return storage_io_submit(io, TRUE, offset, size, buf);
+}
+
+EFI_STATUS storage_io_wait(struct storage_io *io)
+{
+	EFI_DISK_IO2_TOKEN *token;
+	EFI_STATUS ret;
+	UINTN index;
+
+	if (io->count == 0)
+		return io->status;
+
+	token = &io->token[io->head];
+	ret = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &token->Event, &index);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to wait for storage I/O completion");
+	else
+		ret = token->TransactionStatus;
+
+	io->head = (io->head + 1) % STORAGE_IO_DEPTH;
+	io->count--;
+
+	if (EFI_ERROR(ret)) {
+		if (!EFI_ERROR(io->status)) {
+			efi_perror(ret, L"Storage I/O request failed");
+			io->status = ret;
+		}
+		return ret;
+	}
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS storage_io_sync(struct storage_io *io)
+{
+	while (io->count)
+		storage_io_wait(io);
+
+	return io->status;
+}
+
+EFI_STATUS storage_io_close(struct storage_io *io)
+{
+	EFI_STATUS ret;
+
+	if (!io)
+		return EFI_INVALID_PARAMETER;
+
+	ret = storage_io_sync(io);
+	close_events(io);
+	FreePool(io);
+
+	return ret;
+}
+
+static EFI_STATUS storage_transfer(struct gpt_partition_interface *gparti,
+				   BOOLEAN write, UINT64 offset, UINT64 len, VOID *buf)
+{
+	struct storage_io *io;
+	EFI_STATUS ret;
+	UINTN size;
+
+	if (!gparti || !buf)
+		return EFI_INVALID_PARAMETER;
+
+	/* Nothing to overlap */
+	if (len <= STORAGE_IO_CHUNK)
+		return uefi_call_wrapper((write ? gparti->dio->WriteDisk : gparti->dio->ReadDisk),
+					 5, gparti->dio, gparti->bio->Media->MediaId,
+					 offset, len, buf);
+
+	ret = storage_io_open(gparti, &io);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (!storage_io_is_async(io)) {
+		storage_io_close(io);
+		return uefi_call_wrapper((write ? gparti->dio->WriteDisk : gparti->dio->ReadDisk),
+					 5, gparti->dio, gparti->bio->Media->MediaId,
+					 offset, len, buf);
+	}
+
+	while (len) {
+		size = min(len, (UINT64)STORAGE_IO_CHUNK);
+		ret = storage_io_submit(io, write, offset, size, buf);
+		if (EFI_ERROR(ret))
+			break;
+		offset += size;
+		buf = (UINT8 *)buf + size;
+		len -= size;
+	}
+
+	return storage_io_close(io);
+}
+
+EFI_STATUS storage_read(struct gpt_partition_interface *gparti, UINT64 offset,
+			UINT64 len, VOID *buf)
+{
+	return storage_transfer(gparti, FALSE, offset, len, buf);
+}
+
+EFI_STATUS storage_write(struct gpt_partition_interface *gparti, UINT64 offset,
+			 UINT64 len, VOID *buf)
+{
+	return storage_transfer(gparti, TRUE, offset, len, buf);
+}
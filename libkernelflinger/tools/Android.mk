@@ -10,3 +10,14 @@ LOCAL_CFLAGS += -O2 -g -Wall -Werror -pedantic
 LOCAL_MODULE := png2c
 
 include $(BUILD_HOST_EXECUTABLE)
+
+################################
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := upng_bench.c ../upng.c
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/host $(LOCAL_PATH)/../../include
+LOCAL_CFLAGS += -O2 -g -Wall -Wno-pointer-sign
+LOCAL_MODULE := upng_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,30 @@
+#!/bin/bash -e
+
+header="/* This is an autogenerated header file. Please use gen_images.sh */\n\n"
+images=($1/*.png)
+output=$2
+
+echo -e "$header" > $output
+
+for file in ${images[*]}
+do
+    name=$(basename ${file%.png})
+    png2c -i $file -o - -f BLT -r -p "__"$name >> $output
+done
+
+echo -en "\nui_image_t ui_images[] = {" >> $output
+prefix=""
+for file in ${images[*]}
+do
+    name=$(basename ${file%.png})
+
+    if [ $file != ${images[0]} ]
+    then
+        prefix=","
+    fi
+
+    width=$(file $file | cut -d ' ' -f 5)
+    height=$(file $file | cut -d ' ' -f 7 | sed 's/,//')
+    echo -en "$prefix\n\t{ .name = \"$name\", .data = __"$name"_dat, .size = sizeof(__"$name"_dat), .rle = TRUE, .width = $width, .height = $height }" >> $output
+done
+echo -e "\n};" >> $output
@@ -49,14 +49,15 @@ static char *program_name;
 
 static void usage(int status)
 {
-	printf("Usage: %s -i FILE -o FILE -f FORMAT -p NAME\n",
+	printf("Usage: %s -i FILE -o FILE -f FORMAT -p NAME [-r]\n",
 	       basename((char *)program_name));
 	printf("\
 Transform PNG file to C source data structure.\n\
   -o, --output-file=FILE        write data into FILE instead of printing it\n\
   -i, --input-file=FILE         write data into FILE instead of printing it\n\
-  -f, --output-format=FORMAT    allowed values are: RGBA, BGRA, GRAY\n\
+  -f, --output-format=FORMAT    allowed values are: RGBA, BGRA, GRAY, BLT\n\
   -p, --prefix=NAME             prefix name for C content\n\
+  -r, --rle                     run-length encode the 4 bytes pixels\n\
   -h, --help                    display this help\n\
 ");
 	exit(status);
@@ -100,31 +101,150 @@ static void write_to_c_source(const char *name, png_bytep buffer,
 		fclose(f);
 }
 
-static png_uint_32 get_format_from_string(const char *str)
+static png_uint_32 get_format_from_string(const char *str, bool *blt)
 {
 	static struct str_to_format {
 		const char *str;
 		png_uint_32 format;
+		bool blt;
 	} formats[] = {
-		{ "RGBA", PNG_FORMAT_RGBA },
-		{ "BGRA", PNG_FORMAT_BGRA },
-		{ "GRAY", PNG_FORMAT_GRAY }
+		{ "RGBA", PNG_FORMAT_RGBA, false },
+		{ "BGRA", PNG_FORMAT_BGRA, false },
+		{ "GRAY", PNG_FORMAT_GRAY, false },
+		{ "BLT", PNG_FORMAT_BGRA, true }
 	};
 	unsigned int i;
 
 	for (i = 0; i < ARRAY_SIZE(formats); i++)
-		if (!strcmp(str, formats[i].str))
+		if (!strcmp(str, formats[i].str)) {
+			*blt = formats[i].blt;
 			return formats[i].format;
+		}
 
 	usage(EXIT_FAILURE);
 	return 0;
 }
 
+/* The BLT format is the EFI_GRAPHICS_OUTPUT_BLT_PIXEL layout as
+ * upng_load() produces it at runtime: BGR samples as stored in the
+ * file, without gamma correction, and a cleared reserved byte.  The
+ * simplified libpng API always applies the file gamma so the
+ * low-level API is used instead.  */
+static png_bytep read_blt(const char *path, unsigned int *size)
+{
+	png_structp png;
+	png_infop info;
+	png_bytepp rows;
+	png_bytep buffer;
+	png_uint_32 width, height, y, i;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		error("Failed to open PNG file.");
+
+	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png)
+		error("Failed to allocate PNG structure.");
+
+	info = png_create_info_struct(png);
+	if (!info)
+		error("Failed to allocate PNG structure.");
+
+	if (setjmp(png_jmpbuf(png)))
+		error("Failed to read PNG file.");
+
+	png_init_io(png, f);
+	png_read_info(png, info);
+
+	png_set_expand(png);
+	png_set_strip_16(png);
+	png_set_gray_to_rgb(png);
+	png_set_filler(png, 0, PNG_FILLER_AFTER);
+	png_set_bgr(png);
+	png_set_interlace_handling(png);
+	png_read_update_info(png, info);
+
+	width = png_get_image_width(png, info);
+	height = png_get_image_height(png, info);
+	*size = width * height * 4;
+
+	buffer = malloc(*size);
+	rows = malloc(height * sizeof(*rows));
+	if (!buffer || !rows)
+		error("Failed to allocate buffer.");
+
+	for (y = 0; y < height; y++)
+		rows[y] = buffer + y * width * 4;
+
+	png_read_image(png, rows);
+	png_read_end(png, NULL);
+
+	for (i = 3; i < *size; i += 4)
+		buffer[i] = 0;
+
+	png_destroy_read_struct(&png, &info, NULL);
+	free(rows);
+	fclose(f);
+
+	return buffer;
+}
+
+/* Run-length encoding of 4 bytes pixels.  Each packet starts with a
+ * control byte C: if C & 0x80, the following pixel is repeated
+ * (C & 0x7F) + 1 times, otherwise C + 1 pixels follow as is.  */
+#define PIXEL_SIZE 4
+#define RLE_RUN 0x80
+#define RLE_MAX 128
+
+static png_bytep rle_encode(png_bytep buffer, unsigned int size,
+			    unsigned int *rle_size)
+{
+	unsigned int nb = size / PIXEL_SIZE;
+	unsigned int i, n, len = 0;
+	png_bytep rle;
+
+#define PIXEL(i) (buffer + (i) * PIXEL_SIZE)
+#define SAME(i, j) (!memcmp(PIXEL(i), PIXEL(j), PIXEL_SIZE))
+
+	rle = malloc(size + (nb + RLE_MAX - 1) / RLE_MAX);
+	if (!rle)
+		error("Failed to allocate RLE buffer.");
+
+	for (i = 0; i < nb; i += n) {
+		for (n = 1; i + n < nb && n < RLE_MAX && SAME(i, i + n); n++)
+			;
+
+		if (n > 1) {
+			rle[len++] = RLE_RUN | (n - 1);
+			memcpy(rle + len, PIXEL(i), PIXEL_SIZE);
+			len += PIXEL_SIZE;
+			continue;
+		}
+
+		/* Literal pixels up to the beginning of the next run */
+		for (n = 1; i + n < nb && n < RLE_MAX; n++)
+			if (i + n + 1 < nb && SAME(i + n, i + n + 1))
+				break;
+
+		rle[len++] = n - 1;
+		memcpy(rle + len, PIXEL(i), n * PIXEL_SIZE);
+		len += n * PIXEL_SIZE;
+	}
+
+#undef SAME
+#undef PIXEL
+
+	*rle_size = len;
+	return rle;
+}
+
 static struct option const long_options[] = {
 	{"input-file", required_argument, NULL, 'i'},
 	{"output-file", required_argument, NULL, 'o'},
 	{"output-format", required_argument, NULL, 'f'},
 	{"prefix", required_argument, NULL, 'p'},
+	{"rle", no_argument, NULL, 'r'},
 	{"help", no_argument, NULL, 'h'},
 	{NULL, 0, NULL, 0}
 };
@@ -132,9 +252,11 @@ static struct option const long_options[] = {
 int main(int argc, char **argv)
 {
 	png_image image;
-	png_bytep buffer;
+	png_bytep buffer, rle;
 	unsigned int size;
 	bool format_initialized = false;
+	bool blt = false;
+	bool use_rle = false;
 	png_uint_32 format = 0;
 	const char *ipath = NULL;
 	const char *opath = NULL;
@@ -143,7 +265,7 @@ int main(int argc, char **argv)
 
 	program_name = argv[0];
 
-	while ((c = getopt_long(argc, argv, "i:o:f:p:h", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "i:o:f:p:rh", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'i':
 			ipath = optarg;
@@ -155,9 +277,12 @@ int main(int argc, char **argv)
 			prefix = optarg;
 			break;
 		case 'f':
-			format = get_format_from_string(optarg);
+			format = get_format_from_string(optarg, &blt);
 			format_initialized = true;
 			break;
+		case 'r':
+			use_rle = true;
+			break;
 		case 'h':
 			usage(EXIT_SUCCESS);
 			break;
@@ -170,25 +295,39 @@ int main(int argc, char **argv)
 	if (!format_initialized || !opath || !ipath || !prefix)
 		usage(EXIT_FAILURE);
 
-	memset(&image, 0, sizeof(image));
-	image.version = PNG_IMAGE_VERSION;
+	if (use_rle && PNG_IMAGE_PIXEL_SIZE(format) != PIXEL_SIZE)
+		usage(EXIT_FAILURE);
 
-	if (!png_image_begin_read_from_file(&image, ipath))
-		error("Failed to open PNG file.");
+	if (blt)
+		buffer = read_blt(ipath, &size);
+	else {
+		memset(&image, 0, sizeof(image));
+		image.version = PNG_IMAGE_VERSION;
 
-	image.format = format;
-	size = PNG_IMAGE_SIZE(image);
+		if (!png_image_begin_read_from_file(&image, ipath))
+			error("Failed to open PNG file.");
 
-	buffer = malloc(size);
-	if (!buffer)
-		error("Failed to allocate buffer.");
+		image.format = format;
+		size = PNG_IMAGE_SIZE(image);
 
-	if (!png_image_finish_read(&image, NULL, buffer, 0, NULL))
-		error("Failed to read  PNG file.");
+		buffer = malloc(size);
+		if (!buffer)
+			error("Failed to allocate buffer.");
+
+		if (!png_image_finish_read(&image, NULL, buffer, 0, NULL))
+			error("Failed to read  PNG file.");
+
+		png_image_free(&image);
+	}
+
+	if (use_rle) {
+		rle = rle_encode(buffer, size, &size);
+		free(buffer);
+		buffer = rle;
+	}
 
 	write_to_c_source(prefix, buffer, size, opath);
 
-	png_image_free(&image);
 	free(buffer);
 
 	return EXIT_SUCCESS;
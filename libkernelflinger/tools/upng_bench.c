@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2024, Intel Corporation
+ * All rights reserved.
+ *
+ * Authors: Jeremy Compostella <jeremy.compostella@intel.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/* Host micro-benchmark of upng_load(), the PNG decoder used for the
+ * UI images, e.g.:
+ *   upng_bench -n 100 libkernelflinger/res/images/splash_intel.png */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <efi.h>
+#include <efilib.h>
+#include <upng.h>
+
+static char *program_name;
+
+static void usage(int status)
+{
+	printf("Usage: %s [-n COUNT] FILE...\n", basename(program_name));
+	printf("\
+Decode each PNG FILE COUNT times with upng and report the average time.\n\
+  -n, --count=COUNT             number of iterations, default is 50\n\
+  -h, --help                    display this help\n\
+");
+	exit(status);
+}
+
+static void error(const char *s)
+{
+	perror(s);
+	exit(EXIT_FAILURE);
+}
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+	unsigned char *data;
+	FILE *f;
+	long len;
+
+	f = fopen(path, "rb");
+	if (!f)
+		error("Failed to open file.");
+
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET))
+		error("Failed to get the file size.");
+
+	data = malloc(len);
+	if (!data)
+		error("Failed to allocate buffer.");
+
+	if (fread(data, 1, len, f) != (size_t)len)
+		error("Failed to read file.");
+
+	fclose(f);
+	*size = len;
+	return data;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static struct option const long_options[] = {
+	{"count", required_argument, NULL, 'n'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char **argv)
+{
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt;
+	UINTN width, height;
+	EFI_STATUS ret;
+	unsigned char *data;
+	size_t size;
+	unsigned int i, count = 50;
+	double start, elapsed, total = 0;
+	int c;
+
+	program_name = argv[0];
+
+	while ((c = getopt_long(argc, argv, "n:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		default:
+			usage(EXIT_FAILURE);
+			break;
+		}
+	}
+
+	if (optind == argc || !count)
+		usage(EXIT_FAILURE);
+
+	for (; optind < argc; optind++) {
+		data = read_file(argv[optind], &size);
+
+		start = now_ms();
+		for (i = 0; i < count; i++) {
+			ret = upng_load((const char *)data, size, &blt,
+					&width, &height);
+			if (EFI_ERROR(ret)) {
+				fprintf(stderr, "%s: decoding failed\n",
+					argv[optind]);
+				exit(EXIT_FAILURE);
+			}
+			FreePool(blt);
+		}
+		elapsed = (now_ms() - start) / count;
+		total += elapsed;
+
+		printf("%-40s %4lux%-4lu %8zu bytes %8.3f ms\n",
+		       basename(argv[optind]), (unsigned long)width,
+		       (unsigned long)height, size, elapsed);
+		free(data);
+	}
+
+	printf("%-40s %33.3f ms\n", "total", total);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2024, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include "timer.h"
+#include "trace.h"
+
+#define JSON_HEADER	"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+#define JSON_FOOTER	"]}\n"
+#define JSON_EVENT	"{\"name\":\"%a\",\"ph\":\"%a\",\"ts\":%ld,\"pid\":1,\"tid\":1}"
+/* JSON_EVENT length without the name and with a 20 digits timestamp,
+ * plus the separator.  */
+#define JSON_EVENT_MAX	(sizeof(JSON_EVENT) + 20 + 2)
+
+static struct trace_entry {
+	const char *name;
+	UINT64 tsc;
+	BOOLEAN begin;
+} trace_buf[TRACE_BUF_SIZE];
+static UINTN trace_count;
+
+void trace_event(const char *name, BOOLEAN begin)
+{
+	struct trace_entry *entry;
+
+	entry = &trace_buf[trace_count++ % TRACE_BUF_SIZE];
+	entry->tsc = rdtsc();
+	entry->name = name;
+	entry->begin = begin;
+}
+
+EFI_STATUS trace_to_json(CHAR8 **json, UINTN *len)
+{
+	struct trace_entry *entry;
+	UINT32 tsc_mhz;
+	UINTN first, nb, size, i;
+	CHAR8 *buf;
+	int ret;
+
+	if (!json || !len)
+		return EFI_INVALID_PARAMETER;
+
+	tsc_mhz = get_tsc_mhz();
+	if (tsc_mhz == 0)
+		tsc_mhz = get_cpu_freq();
+	if (tsc_mhz == 0)
+		return EFI_UNSUPPORTED;
+
+	nb = min(trace_count, (UINTN)TRACE_BUF_SIZE);
+	first = trace_count - nb;
+
+	size = sizeof(JSON_HEADER) + sizeof(JSON_FOOTER);
+	for (i = first; i < trace_count; i++)
+		size += strlen((CHAR8 *)trace_buf[i % TRACE_BUF_SIZE].name) +
+			JSON_EVENT_MAX;
+
+	buf = AllocatePool(size);
+	if (!buf)
+		return EFI_OUT_OF_RESOURCES;
+
+	/* strlcat() returns the number of bytes it appended.  */
+	buf[0] = '\0';
+	*len = strlcat(buf, (CHAR8 *)JSON_HEADER, size);
+	for (i = first; i < trace_count; i++) {
+		entry = &trace_buf[i % TRACE_BUF_SIZE];
+		ret = efi_snprintf(buf + *len, size - *len, (CHAR8 *)JSON_EVENT,
+				   entry->name, entry->begin ? "B" : "E",
+				   entry->tsc / tsc_mhz);
+		if (ret < 0) {
+			FreePool(buf);
+			return EFI_BUFFER_TOO_SMALL;
+		}
+		*len += ret;
+		*len += strlcat(buf, (CHAR8 *)(i + 1 < trace_count ? ",\n" : "\n"),
+			       size);
+	}
+	*len += strlcat(buf, (CHAR8 *)JSON_FOOTER, size);
+
+	*json = buf;
+	return EFI_SUCCESS;
+}
@@ -37,6 +37,12 @@
 #include <lib.h>
 #include <ui.h>
 
+/* On x86, the scaler uses SSE2 or AVX2 when the CPU supports them.  */
+#if defined(__x86_64__) || defined(__i386__)
+#define UI_SCALE_SIMD
+#include <immintrin.h>
+#endif
+
 #define NOT_READY_USECS	(100 * 1000)
 
 /* Time between calls to ReadKeyStroke to check if it is being actively held
@@ -260,9 +266,11 @@ EFI_STATUS ui_clear_area(UINTN x, UINTN y, UINTN width, UINTN height)
 
 	ret = ui_fill_area(x, y, width, height, &COLOR_BLACK);
 
-	if (default_textarea)
+	if (default_textarea) {
+		ui_textarea_invalidate(default_textarea);
 		ret = ui_textarea_draw(default_textarea, default_textarea_x,
 				       default_textarea_y);
+	}
 	return ret;
 }
 
@@ -533,7 +541,10 @@ ui_events_t ui_wait_for_event(UINTN timeout_secs, ui_events_t expected)
 
 	ui_wait_for_key_release();
 	do {
-		ui_events_t event = ui_read_input();
+		ui_events_t event;
+
+		log_drain();
+		event = ui_read_input();
 		if (event != EV_NONE &&
 		    (expected == EV_ANY || event == expected))
 			return event;
@@ -604,35 +615,295 @@ void ui_get_scaled_dimension(UINTN orig_width, UINTN orig_height,
 }
 
 /*
- * Bilinear interpolation:
- * f(x,y) = (1/(x2-x1)(y2-y1)) * (f(Q11)(x2-x)(y2-y) +
- *				f(Q21)(x-x1)(y2-y) +
- *				f(Q12)(x2-x)(y-y1) +
- *				f(Q22)(x-x1)(y-y1))
+ * Bilinear interpolation, in two separable passes: each source row
+ * needed is first scaled horizontally, then the two rows around each
+ * destination row are blended.  Positions are 16.16 fixed-point
+ * numbers and weights are 8 bits.  The two passes use the same
+ * blend, with SSE2 or AVX2 kernels processing four or eight pixels at
+ * a time when the CPU supports them.  The portable SWAR blend, which
+ * processes two channels of a pixel per multiply, is the fallback.
+ * All of them compute the same values.
  */
-void ui_bilinear_scale(unsigned char *s, unsigned char *d,
-		       int sx, int sy, int dx, int dy,
-		       int depth)
-{
-	double ratio_x = (double)(sx - 1) / dx;
-	double ratio_y = (double)(sy - 1) / dy;
-	int i, j, k;
-	sx *= depth;
-	for (i = 0; i < dy; i++ )
-		for (j = 0; j < dx; j++) {
-			double x = j * ratio_x;
-			double y = i * ratio_y;
-			int x1 = x;
-			int x2 = x1 + 1;
-			int y1 = y;
-			int y2 = y1 + 1;
-			for (k = 0; k < depth; k++) {
-				d[j * depth + i * dx * depth + k] =(int)((1 / ((x2 - x1) * (y2 - y1))) *
-					(s[x1 * depth + y1 * sx + k] * (x2 - x) * (y2 - y) +
-					 s[x2 * depth + y1 * sx + k] * (x - x1) * (y2 - y) +
-					 s[x1 * depth + y2 * sx + k] * (x2 - x) * (y - y1) +
-					 s[x2 * depth + y2 * sx + k] * (x - x1) * (y - y1)));
-			}
-		}
+#define SCALE_SHIFT	16
+#define WEIGHT_SHIFT	8
+
+/* Blend the A and B BGRA pixels, W/256 of B */
+static UINT32 blend_pixel(UINT32 a, UINT32 b, UINT32 w)
+{
+	UINT32 rb, ga;
+
+	rb = ((a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w) >> WEIGHT_SHIFT;
+	ga = ((a >> 8) & 0x00ff00ff) * (256 - w) + ((b >> 8) & 0x00ff00ff) * w;
+
+	return (rb & 0x00ff00ff) | (ga & 0xff00ff00);
+}
+
+#ifdef UI_SCALE_SIMD
+/* Blend the A and B pixels, W holding the weight of each pixel in
+   both 16-bit halves of its lane.  The channels are widened to 16 bits
+   where a * (256 - w) + b * w cannot overflow.  */
+__attribute__((target("sse2")))
+static inline __m128i blend_sse2(__m128i a, __m128i b, __m128i w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(256);
+	__m128i wl = _mm_unpacklo_epi32(w, w), wh = _mm_unpackhi_epi32(w, w);
+	__m128i lo, hi;
+
+	lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero),
+					   _mm_sub_epi16(full, wl)),
+			   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wl));
+	hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero),
+					   _mm_sub_epi16(full, wh)),
+			   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wh));
+
+	return _mm_packus_epi16(_mm_srli_epi16(lo, WEIGHT_SHIFT),
+				_mm_srli_epi16(hi, WEIGHT_SHIFT));
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2(UINT32 *d, UINT32 *a, UINT32 *b, UINTN width,
+			   UINT32 w)
+{
+	__m128i wv = _mm_set1_epi16(w);
+	UINTN i;
+
+	for (i = 0; i + 4 <= width; i += 4)
+		_mm_storeu_si128((__m128i *)&d[i],
+				 blend_sse2(_mm_loadu_si128((__m128i *)&a[i]),
+					    _mm_loadu_si128((__m128i *)&b[i]), wv));
+
+	for (; i < width; i++)
+		d[i] = blend_pixel(a[i], b[i], w);
+}
+
+__attribute__((target("sse2")))
+static void scale_row_sse2(UINT32 *d, UINT32 *s, UINTN sx, UINTN dx,
+			   UINT32 *pos, UINT8 *weight)
+{
+	__m128i a, b, w;
+	UINTN j;
+
+	for (j = 0; j + 4 <= dx; j += 4) {
+		a = _mm_setr_epi32(s[pos[j]], s[pos[j + 1]],
+				   s[pos[j + 2]], s[pos[j + 3]]);
+		b = _mm_setr_epi32(s[min(pos[j] + 1, sx - 1)],
+				   s[min(pos[j + 1] + 1, sx - 1)],
+				   s[min(pos[j + 2] + 1, sx - 1)],
+				   s[min(pos[j + 3] + 1, sx - 1)]);
+		w = _mm_setr_epi32(weight[j], weight[j + 1],
+				   weight[j + 2], weight[j + 3]);
+		w = _mm_or_si128(w, _mm_slli_epi32(w, 16));
+		_mm_storeu_si128((__m128i *)&d[j], blend_sse2(a, b, w));
+	}
+
+	for (; j < dx; j++)
+		d[j] = blend_pixel(s[pos[j]], s[min(pos[j] + 1, sx - 1)], weight[j]);
+}
+
+/* Same as blend_sse2() on eight pixels.  The unpack instructions work
+   within each 128-bit lane, and so do the weights.  */
+__attribute__((target("avx2")))
+static inline __m256i blend_avx2(__m256i a, __m256i b, __m256i w)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i full = _mm256_set1_epi16(256);
+	__m256i wl = _mm256_unpacklo_epi32(w, w), wh = _mm256_unpackhi_epi32(w, w);
+	__m256i lo, hi;
+
+	lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero),
+						 _mm256_sub_epi16(full, wl)),
+			      _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), wl));
+	hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero),
+						 _mm256_sub_epi16(full, wh)),
+			      _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), wh));
+
+	return _mm256_packus_epi16(_mm256_srli_epi16(lo, WEIGHT_SHIFT),
+				   _mm256_srli_epi16(hi, WEIGHT_SHIFT));
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2(UINT32 *d, UINT32 *a, UINT32 *b, UINTN width,
+			   UINT32 w)
+{
+	__m256i wv = _mm256_set1_epi16(w);
+	UINTN i;
+
+	for (i = 0; i + 8 <= width; i += 8)
+		_mm256_storeu_si256((__m256i *)&d[i],
+				    blend_avx2(_mm256_loadu_si256((__m256i *)&a[i]),
+					       _mm256_loadu_si256((__m256i *)&b[i]), wv));
+
+	for (; i < width; i++)
+		d[i] = blend_pixel(a[i], b[i], w);
+}
+
+__attribute__((target("avx2")))
+static void scale_row_avx2(UINT32 *d, UINT32 *s, UINTN sx, UINTN dx,
+			   UINT32 *pos, UINT8 *weight)
+{
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i last = _mm256_set1_epi32(sx - 1);
+	__m256i idx, a, b, w;
+	UINTN j;
+
+	for (j = 0; j + 8 <= dx; j += 8) {
+		idx = _mm256_loadu_si256((__m256i *)&pos[j]);
+		a = _mm256_i32gather_epi32((const int *)s, idx, 4);
+		idx = _mm256_min_epu32(_mm256_add_epi32(idx, one), last);
+		b = _mm256_i32gather_epi32((const int *)s, idx, 4);
+		w = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)&weight[j]));
+		w = _mm256_or_si256(w, _mm256_slli_epi32(w, 16));
+		_mm256_storeu_si256((__m256i *)&d[j], blend_avx2(a, b, w));
+	}
+
+	for (; j < dx; j++)
+		d[j] = blend_pixel(s[pos[j]], s[min(pos[j] + 1, sx - 1)], weight[j]);
+}
+
+enum scale_kernel {
+	SCALE_SWAR,
+	SCALE_SSE2,
+	SCALE_AVX2
+};
+
+static enum scale_kernel scale_kernel(void)
+{
+	/* -1: not probed yet */
+	static INTN kernel = -1;
+	UINT32 reg[4], xcr0_lo, xcr0_hi;
+
+	if (kernel >= 0)
+		return kernel;
+
+	kernel = SCALE_SWAR;
+	cpuid(0, reg);
+	if (reg[0] < 1)
+		return kernel;
+
+	cpuid(1, reg);
+	if (!(reg[3] & (1 << 26)))
+		return kernel;
+	kernel = SCALE_SSE2;
+
+	/* AVX2 also needs the firmware to have enabled the AVX state,
+	   which XGETBV reports when OSXSAVE is set.  */
+	if (reg[0] < 7 || !(reg[2] & (1 << 27)) || !(reg[2] & (1 << 28)))
+		return kernel;
+	asm volatile("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	if ((xcr0_lo & 0x6) != 0x6)
+		return kernel;
+
+	cpuid(7, reg);
+	if (reg[1] & (1 << 5))
+		kernel = SCALE_AVX2;
+
+	return kernel;
+}
+#endif
+
+static void blend_row(UINT32 *d, UINT32 *a, UINT32 *b, UINTN width, UINT32 w)
+{
+	UINTN i;
+
+	if (w == 0) {
+		memcpy(d, a, width * sizeof(*d));
+		return;
+	}
+
+#ifdef UI_SCALE_SIMD
+	switch (scale_kernel()) {
+	case SCALE_AVX2:
+		blend_row_avx2(d, a, b, width, w);
+		return;
+	case SCALE_SSE2:
+		blend_row_sse2(d, a, b, width, w);
+		return;
+	default:
+		break;
+	}
+#endif
+
+	for (i = 0; i < width; i++)
+		d[i] = blend_pixel(a[i], b[i], w);
+}
+
+static void scale_row(UINT32 *d, UINT32 *s, UINTN sx, UINTN dx,
+		      UINT32 *pos, UINT8 *weight)
+{
+	UINTN j;
+
+#ifdef UI_SCALE_SIMD
+	switch (scale_kernel()) {
+	case SCALE_AVX2:
+		scale_row_avx2(d, s, sx, dx, pos, weight);
+		return;
+	case SCALE_SSE2:
+		scale_row_sse2(d, s, sx, dx, pos, weight);
+		return;
+	default:
+		break;
+	}
+#endif
+
+	for (j = 0; j < dx; j++)
+		d[j] = blend_pixel(s[pos[j]], s[min(pos[j] + 1, sx - 1)], weight[j]);
 }
 
+EFI_STATUS ui_bilinear_scale(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *src,
+			     EFI_GRAPHICS_OUTPUT_BLT_PIXEL *dst,
+			     UINTN sx, UINTN sy, UINTN dx, UINTN dy)
+{
+	UINT32 *s = (UINT32 *)src, *d = (UINT32 *)dst;
+	UINT32 *pos, *rows[2], *tmp;
+	UINT8 *weight;
+	INTN row_y[2] = { -1, -1 };
+	UINT64 f;
+	UINTN i, j, y1, y2;
+
+	if (!src || !dst || !sx || !sy || !dx || !dy)
+		return EFI_INVALID_PARAMETER;
+
+	pos = AllocatePool(dx * (3 * sizeof(*pos) + sizeof(*weight)));
+	if (!pos)
+		return EFI_OUT_OF_RESOURCES;
+	rows[0] = pos + dx;
+	rows[1] = rows[0] + dx;
+	weight = (UINT8 *)(rows[1] + dx);
+
+	/* Same sampling as the floating-point version: x = j * (sx - 1) / dx */
+	for (j = 0; j < dx; j++) {
+		f = ((UINT64)j * (sx - 1) << SCALE_SHIFT) / dx;
+		pos[j] = f >> SCALE_SHIFT;
+		weight[j] = (f >> (SCALE_SHIFT - WEIGHT_SHIFT)) & 0xff;
+	}
+
+	for (i = 0; i < dy; i++) {
+		f = ((UINT64)i * (sy - 1) << SCALE_SHIFT) / dy;
+		y1 = f >> SCALE_SHIFT;
+		y2 = min(y1 + 1, sy - 1);
+
+		/* Destination rows move forward, re-use the scaled rows */
+		if (row_y[1] == (INTN)y1) {
+			tmp = rows[0];
+			rows[0] = rows[1];
+			rows[1] = tmp;
+			row_y[0] = y1;
+			row_y[1] = -1;
+		}
+		if (row_y[0] != (INTN)y1) {
+			scale_row(rows[0], s + y1 * sx, sx, dx, pos, weight);
+			row_y[0] = y1;
+		}
+		if (row_y[1] != (INTN)y2) {
+			scale_row(rows[1], s + y2 * sx, sx, dx, pos, weight);
+			row_y[1] = y2;
+		}
+
+		blend_row(d + i * dx, rows[0], rows[1], dx,
+			  (f >> (SCALE_SHIFT - WEIGHT_SHIFT)) & 0xff);
+	}
+
+	FreePool(pos);
+	return EFI_SUCCESS;
+}
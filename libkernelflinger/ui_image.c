@@ -40,6 +40,57 @@
 
 #include "res/img_res.h"
 
+/* Each packet starts with a control byte C: if C & RLE_RUN, the
+ * following pixel is repeated (C & ~RLE_RUN) + 1 times, otherwise
+ * C + 1 pixels follow as is.  See png2c.  */
+#define RLE_RUN 0x80
+
+static EFI_STATUS rle_load(const UINT8 *data, UINTN size,
+			   EFI_GRAPHICS_OUTPUT_BLT_PIXEL **blt,
+			   UINTN width, UINTN height)
+{
+	const UINT8 *end = data + size;
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *pixels, pixel;
+	UINTN i = 0, j, n, count = width * height;
+
+	pixels = AllocatePool(ui_get_blt_size(width, height));
+	if (!pixels)
+		return EFI_OUT_OF_RESOURCES;
+
+	while (data < end) {
+		n = (*data & ~RLE_RUN) + 1;
+		if (n > count - i)
+			goto err;
+
+		if (*data++ & RLE_RUN) {
+			if ((UINTN)(end - data) < sizeof(pixel))
+				goto err;
+			CopyMem(&pixel, data, sizeof(pixel));
+			for (j = 0; j < n; j++)
+				pixels[i + j] = pixel;
+			data += sizeof(pixel);
+		} else {
+			if ((UINTN)(end - data) < n * sizeof(pixel))
+				goto err;
+			CopyMem(pixels + i, data, n * sizeof(pixel));
+			data += n * sizeof(pixel);
+		}
+		i += n;
+	}
+
+	if (i != count)
+		goto err;
+
+	*blt = pixels;
+	return EFI_SUCCESS;
+
+err:
+	FreePool(pixels);
+	return EFI_LOAD_ERROR;
+}
+
+/* Images pre-decoded by png2c at build time only need to be expanded,
+ * PNG images are decoded by upng. */
 ui_image_t *ui_image_get(const char *name)
 {
 	unsigned int i;
@@ -54,8 +105,12 @@ ui_image_t *ui_image_get(const char *name)
 
 	img = &ui_images[i];
 	if (!img->blt) {
-		ret = upng_load(img->data, img->size,
-				&img->blt, &img->width, &img->height);
+		if (img->rle)
+			ret = rle_load(img->data, img->size, &img->blt,
+				       img->width, img->height);
+		else
+			ret = upng_load(img->data, img->size,
+					&img->blt, &img->width, &img->height);
 		if (EFI_ERROR(ret))
 			efi_perror(ret, L"Failed to load image %s",
 				   name);
@@ -75,10 +130,12 @@ EFI_STATUS ui_image_draw(ui_image_t *image, UINTN x, UINTN y)
 	return ret;
 }
 
+/* The last scaled version of each image is kept so that redrawing it
+ * at the same size does not scale it again.  */
 EFI_STATUS ui_image_draw_scale(ui_image_t *image, UINTN x, UINTN y, UINTN width, UINTN height)
 {
-	EFI_STATUS ret = EFI_SUCCESS;
-	ui_image_t to_draw;
+	EFI_STATUS ret;
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt;
 	UINTN new_width, new_height;
 
 	ui_get_scaled_dimension(image->width, image->height,
@@ -87,29 +144,33 @@ EFI_STATUS ui_image_draw_scale(ui_image_t *image, UINTN x, UINTN y, UINTN width,
 	if (new_width == image->width && new_height == image->height)
 		return ui_image_draw(image, x, y);
 
-	ret = memcpy_s(&to_draw, sizeof(to_draw), image, sizeof(to_draw));
-	if (EFI_ERROR(ret))
-		goto out;
-	to_draw.blt = AllocatePool(ui_get_blt_size(new_width, new_height));
-	if (!to_draw.blt) {
-		ret = EFI_OUT_OF_RESOURCES;
-		efi_perror(ret, L"Failed to allocate buffer");
-		goto out;
+	if (!image->scaled_blt || image->scaled_width != new_width ||
+	    image->scaled_height != new_height) {
+		blt = AllocatePool(ui_get_blt_size(new_width, new_height));
+		if (!blt) {
+			ret = EFI_OUT_OF_RESOURCES;
+			efi_perror(ret, L"Failed to allocate buffer");
+			return ret;
+		}
+
+		ret = ui_bilinear_scale(image->blt, blt, image->width, image->height,
+					new_width, new_height);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to scale image %a", image->name);
+			FreePool(blt);
+			return ret;
+		}
+
+		if (image->scaled_blt)
+			FreePool(image->scaled_blt);
+		image->scaled_blt = blt;
+		image->scaled_width = new_width;
+		image->scaled_height = new_height;
 	}
 
-	to_draw.width = new_width;
-	to_draw.height = new_height;
-
-	ui_bilinear_scale((unsigned char *)image->blt,
-			  (unsigned char *)to_draw.blt,
-			  image->width, image->height,
-			  to_draw.width, to_draw.height,
-			  sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
-
-	ret = ui_image_draw(&to_draw, x, y);
+	ret = ui_draw_blt(image->scaled_blt, x, y, new_width, new_height);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to display image %a", image->name);
 
-out:
-	if (to_draw.blt)
-		FreePool(to_draw.blt);
 	return ret;
 }
@@ -38,6 +38,27 @@
 
 #include "ui.h"
 
+static void ui_textarea_fill_bg(ui_textarea_t *textarea, UINTN y,
+				UINTN height)
+{
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *row = textarea->blt + y * textarea->width;
+	UINTN row_size = textarea->width * sizeof(*row);
+	UINTN i;
+
+	if (!height)
+		return;
+
+	if (!textarea->bg_color) {
+		ZeroMem(row, row_size * height);
+		return;
+	}
+
+	for (i = 0; i < textarea->width; i++)
+		row[i] = *textarea->bg_color;
+	for (i = 1; i < height; i++)
+		CopyMem(row + i * textarea->width, row, row_size);
+}
+
 static EFI_STATUS ui_textarea_allocate_blt(ui_textarea_t *textarea)
 {
 	UINTN blt_size;
@@ -46,10 +67,15 @@ static EFI_STATUS ui_textarea_allocate_blt(ui_textarea_t *textarea)
 	textarea->height = textarea->font->cheight * textarea->line_nb;
 
 	blt_size = sizeof(*textarea->blt) * textarea->width * textarea->height;
-	textarea->blt = AllocateZeroPool(blt_size);
+	textarea->blt = AllocatePool(blt_size);
 	if (!textarea->blt)
 		return EFI_OUT_OF_RESOURCES;
 
+	ui_textarea_fill_bg(textarea, 0, textarea->height);
+	textarea->scrolled = 0;
+	textarea->rendered = FALSE;
+	textarea->displayed = FALSE;
+
 	return EFI_SUCCESS;
 }
 
@@ -69,6 +95,7 @@ ui_textarea_t *ui_textarea_create(UINTN line_nb, UINTN row_nb, ui_font_t *font,
 	textarea->line_nb = line_nb;
 	textarea->row_nb = row_nb;
 	textarea->font = font;
+	textarea->bg_color = bg_color;
 
 	if (EFI_ERROR(ui_textarea_allocate_blt(textarea))) {
 		FreePool(textarea);
@@ -83,9 +110,16 @@ ui_textarea_t *ui_textarea_create(UINTN line_nb, UINTN row_nb, ui_font_t *font,
 		return NULL;
 	}
 
+	textarea->dirty = AllocateZeroPool(sizeof(*textarea->dirty) * line_nb);
+	if (!textarea->dirty) {
+		FreePool(textarea->text);
+		FreePool(textarea->blt);
+		FreePool(textarea);
+		return NULL;
+	}
+
 	textarea->current = -1;
 	textarea->color = color;
-	textarea->bg_color = bg_color;
 
 	return textarea;
 }
@@ -124,50 +158,80 @@ static void ui_textarea_copy_char(unsigned char *src_p, UINTN src_row_bytes,
 	}
 }
 
-static void ui_textarea_refresh_blt(ui_textarea_t *textarea)
+/* Render text line CUR in the displayed line SLOT of the blt. */
+static void ui_textarea_render_line(ui_textarea_t *textarea, UINTN cur,
+				    UINTN slot)
 {
-	UINTN cur, i, j, x, y = 0;
+	UINTN j, x, y;
 	ui_font_t *font = textarea->font;
 	UINTN pixel_size = sizeof(*textarea->blt);
 	UINTN row_size = textarea->width * pixel_size;
 	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *color;
-	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *bg_color = textarea->bg_color;
 
-	ZeroMem(textarea->blt,
-		textarea->width * textarea->height * sizeof(*textarea->blt));
+	y = slot * font->cheight;
+	ui_textarea_fill_bg(textarea, y, font->cheight);
 
-	for (i = 1; i <= textarea->line_nb; i++) {
-		cur = (textarea->current + i) % textarea->line_nb;
+	color = textarea->color;
+	if (textarea->text[cur].color)
+		color = textarea->text[cur].color;
 
-		color = textarea->color;
-		if (textarea->text[cur].color)
-			color = textarea->text[cur].color;
+	unsigned char *s = (unsigned char *)textarea->text[cur].str;
+	for (x = 0, j = 0; s && *s && j < textarea->row_nb; s++, x += font->cwidth, j++) {
+		if (*s <= 0x20 || *s > 0x7E)
+			continue;
+		if (*s == '\n')
+			break;
 
-		if (bg_color) {
-			UINTN x1;
-			for (x1 = 0; x1 < textarea->height * textarea->width; x1++)
-				CopyMem(textarea->blt + x1, bg_color,
-					sizeof(bg_color));
-		}
+		unsigned char* src_p = font->texture + ((*s - 0x20) * font->cwidth)
+			+ (textarea->text[cur].bold ? font->cheight * font->width : 0);
+		unsigned char* dst_p = ((unsigned char *)textarea->blt)
+			+ (y * row_size)
+			+ (x * pixel_size);
 
-		unsigned char *s = (unsigned char *)textarea->text[cur].str;
-		for (x = 0, j = 0; s && *s && j < textarea->row_nb; s++, x += font->cwidth, j++) {
-			if (*s <= 0x20 || *s > 0x7E)
-				continue;
-			if (*s == '\n')
-				break;
-
-			unsigned char* src_p = font->texture + ((*s - 0x20) * font->cwidth)
-				+ (textarea->text[cur].bold ? font->cheight * font->width : 0);
-			unsigned char* dst_p = ((unsigned char *)textarea->blt)
-				+ (y * row_size)
-				+ (x * pixel_size);
-
-			ui_textarea_copy_char(src_p, font->width, dst_p, row_size,
-					      font->cwidth, font->cheight, color);
-		}
-		y += font->cheight;
+		ui_textarea_copy_char(src_p, font->width, dst_p, row_size,
+				      font->cwidth, font->cheight, color);
+	}
+}
+
+/* Bring the blt up to date with the text and return in [FIRST, LAST[
+ * the range of displayed lines which changed.  Scrolled lines are
+ * moved rather than rendered again and only the dirty lines are
+ * rasterized. */
+static void ui_textarea_refresh_blt(ui_textarea_t *textarea,
+				    UINTN *first, UINTN *last)
+{
+	UINTN cur, i, line_nb = textarea->line_nb;
+	UINTN cheight = textarea->font->cheight;
+	UINTN scrolled = textarea->scrolled;
+	BOOLEAN all;
+
+	all = !textarea->rendered || !textarea->dirty || scrolled >= line_nb;
+
+	*first = all || scrolled ? 0 : line_nb;
+	*last = all || scrolled ? line_nb : 0;
+
+	if (!all && scrolled) {
+		CopyMem(textarea->blt, textarea->blt + scrolled * cheight * textarea->width,
+			(line_nb - scrolled) * cheight * textarea->width * sizeof(*textarea->blt));
+		ui_textarea_fill_bg(textarea, (line_nb - scrolled) * cheight,
+				    scrolled * cheight);
 	}
+
+	for (i = 1; i <= line_nb; i++) {
+		cur = (textarea->current + i) % line_nb;
+
+		if (!all && !textarea->dirty[cur])
+			continue;
+
+		ui_textarea_render_line(textarea, cur, i - 1);
+		if (textarea->dirty)
+			textarea->dirty[cur] = FALSE;
+		*first = min(*first, i - 1);
+		*last = max(*last, i);
+	}
+
+	textarea->scrolled = 0;
+	textarea->rendered = TRUE;
 }
 
 EFI_STATUS ui_textarea_display_text(const ui_textline_t *text, ui_font_t *font,
@@ -196,6 +260,7 @@ EFI_STATUS ui_textarea_display_text(const ui_textline_t *text, ui_font_t *font,
 	textarea.bg_color = bg_color;
 	textarea.font = font;
 	textarea.current = -1;
+	textarea.dirty = NULL;
 
 	ret = ui_textarea_allocate_blt(&textarea);
 	if (EFI_ERROR(ret))
@@ -211,6 +276,7 @@ void ui_textarea_free(ui_textarea_t *textarea)
 	ui_textarea_clear(textarea);
 	FreePool(textarea->blt);
 	FreePool(textarea->text);
+	FreePool(textarea->dirty);
 	FreePool(textarea);
 }
 
@@ -225,6 +291,7 @@ void ui_textarea_clear(ui_textarea_t *textarea)
 		}
 
 	textarea->current = -1;
+	textarea->rendered = FALSE;
 }
 
 void ui_textarea_set_line(ui_textarea_t *textarea, UINTN line_nb, char *str,
@@ -233,6 +300,7 @@ void ui_textarea_set_line(ui_textarea_t *textarea, UINTN line_nb, char *str,
 	textarea->text[line_nb].str = str;
 	textarea->text[line_nb].color = color;
 	textarea->text[line_nb].bold = bold;
+	textarea->dirty[line_nb] = TRUE;
 }
 
 void ui_textarea_set_line_n(ui_textarea_t *textarea, UINTN line_nb, char *str,
@@ -267,12 +335,14 @@ void ui_textarea_set_line_n(ui_textarea_t *textarea, UINTN line_nb, char *str,
 	textarea->text[line_nb].str = newbuf;
 	textarea->text[line_nb].color = color;
 	textarea->text[line_nb].bold = bold;
+	textarea->dirty[line_nb] = TRUE;
 }
 
 void ui_textarea_newline(ui_textarea_t *textarea, char *str,
 			 EFI_GRAPHICS_OUTPUT_BLT_PIXEL *color, BOOLEAN bold)
 {
 	textarea->current = (textarea->current + 1) % textarea->line_nb;
+	textarea->scrolled = min(textarea->scrolled + 1, textarea->line_nb);
 
 	if (textarea->text[textarea->current].str)
 		FreePool(textarea->text[textarea->current].str);
@@ -292,9 +362,10 @@ EFI_STATUS ui_textarea_draw_scale(ui_textarea_t *textarea, UINTN x, UINTN *y,
 {
 	UINTN new_width, new_height;
 	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *scaled_blt = NULL;
+	UINTN first, last;
 	EFI_STATUS ret;
 
-	ui_textarea_refresh_blt(textarea);
+	ui_textarea_refresh_blt(textarea, &first, &last);
 
 	ui_get_scaled_dimension(textarea->width, textarea->height,
 				width, height, &new_width, &new_height);
@@ -302,20 +373,43 @@ EFI_STATUS ui_textarea_draw_scale(ui_textarea_t *textarea, UINTN x, UINTN *y,
 	if (!scaled_blt)
 		return EFI_OUT_OF_RESOURCES;
 
-	ui_bilinear_scale((unsigned char *)textarea->blt,
-			  (unsigned char *)scaled_blt,
-			  textarea->width, textarea->height,
-			  new_width, new_height,
-			  sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
-	ret = ui_draw_blt(scaled_blt, x, *y, new_width, new_height);
+	ret = ui_bilinear_scale(textarea->blt, scaled_blt,
+				textarea->width, textarea->height,
+				new_width, new_height);
+	if (!EFI_ERROR(ret))
+		ret = ui_draw_blt(scaled_blt, x, *y, new_width, new_height);
 	FreePool(scaled_blt);
 	*y += new_height;
 
 	return ret;
 }
 
+/* Only the band of lines which changed since the previous call is
+ * sent to the screen, unless ui_textarea_invalidate() was called in
+ * between. */
 EFI_STATUS ui_textarea_draw(ui_textarea_t *textarea, UINTN x, UINTN y)
 {
-	ui_textarea_refresh_blt(textarea);
-	return ui_draw_blt(textarea->blt, x, y, textarea->width, textarea->height);
+	UINTN first, last, offset;
+	EFI_STATUS ret;
+
+	ui_textarea_refresh_blt(textarea, &first, &last);
+	if (!textarea->displayed) {
+		first = 0;
+		last = textarea->line_nb;
+	}
+
+	if (first >= last)
+		return EFI_SUCCESS;
+
+	offset = first * textarea->font->cheight;
+	ret = ui_draw_blt(textarea->blt + offset * textarea->width, x, y + offset,
+			  textarea->width, (last - first) * textarea->font->cheight);
+	textarea->displayed = !EFI_ERROR(ret);
+
+	return ret;
+}
+
+void ui_textarea_invalidate(ui_textarea_t *textarea)
+{
+	textarea->displayed = FALSE;
 }
@@ -60,16 +60,9 @@
 /* Largest number of symbols used by any tree type */
 #define MAX_SYMBOLS 288
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
-#define CODE_LENGTH_BITLEN 7
 /* Largest bitlen used by any tree type */
 #define MAX_BIT_LENGTH 15
 
-#define DEFLATE_CODE_BUFFER_SIZE	(NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE		(NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE		(NUM_DISTANCE_SYMBOLS * 2)
-
 #define SET_ERROR(upng,code) do { \
 		(upng)->error = (code); \
 		(upng)->error_line = __LINE__; \
@@ -132,14 +125,29 @@ typedef struct {
 	upng_source	source;
 } upng_t;
 
+/* Codes up to HUFFMAN_FAST_BITS long are decoded with a single
+   lookup in the fast table, indexed by the next bits of the stream.
+   Each entry holds (symbol << 4) | length, 0 if the code is longer.
+   Longer codes are decoded canonically, as described in RFC 1951,
+   with the maxcode, firstcode and firstsymbol tables. */
+#define HUFFMAN_FAST_BITS 9
+#define HUFFMAN_FAST_MASK ((1 << HUFFMAN_FAST_BITS) - 1)
+
 typedef struct huffman_tree {
-	unsigned *tree2d;
-	unsigned  maxbitlen;   /* Maximum number of bits a single code
-				  can get */
+	UINT16    fast[1 << HUFFMAN_FAST_BITS];
+	/* First code after the codes of each length, left aligned on
+	   16 bits */
+	UINT32    maxcode[MAX_BIT_LENGTH + 1];
+	UINT16    firstcode[MAX_BIT_LENGTH + 1];
+	UINT16    firstsymbol[MAX_BIT_LENGTH + 1];
+	/* Symbols sorted by code */
+	UINT16    symbols[MAX_SYMBOLS];
 	unsigned  numcodes;	/* Number of symbols in the alphabet =
 				   number of codes */
 } huffman_tree;
 
+typedef UINT64 __attribute__((may_alias, aligned(1))) unaligned_u64;
+
 /* The base lengths represented by codes 257-285 */
 static const unsigned LENGTH_BASE[29] = {
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
@@ -172,173 +180,102 @@ static const unsigned CLCL[NUM_CODE_LENGTH_CODES] = {
 	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+/* Return the bits of the stream from bit position BP on, loaded a
+   word at a time.  Bits past the end of the input read as zero. */
+static UINT32 peek_bits(const unsigned char *bitstream, unsigned long bp,
+			unsigned long inlength)
+{
+	unsigned long i, byte = bp >> 3;
+	UINT64 word = 0;
 
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
-};
+	if (byte + sizeof(word) <= inlength)
+		word = *(const unaligned_u64 *)(bitstream + byte);
+	else
+		for (i = 0; byte + i < inlength && i < sizeof(word); i++)
+			word |= (UINT64)bitstream[byte + i] << (i * 8);
+
+	return (UINT32)(word >> (bp & 0x7));
+}
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream,
+			  unsigned long inlength, unsigned long nbits)
 {
-	unsigned char result = ((bitstream[(*bitpointer) >> 3] >>
-				 ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
+	unsigned result;
+
+	result = peek_bits(bitstream, *bitpointer, inlength) & ((1U << nbits) - 1);
+	(*bitpointer) += nbits;
 	return result;
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream,
-			  unsigned long nbits)
+static unsigned reverse_bits(unsigned code, unsigned nbits)
 {
 	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+
+	for (i = 0; i < nbits; i++, code >>= 1)
+		result = (result << 1) | (code & 1);
 	return result;
 }
 
-/* The buffer must be numcodes * 2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer,
-			      unsigned numcodes, unsigned maxbitlen)
+static void huffman_tree_init(huffman_tree* tree, unsigned numcodes)
 {
-	tree->tree2d = buffer;
 	tree->numcodes = numcodes;
-	tree->maxbitlen = maxbitlen;
 }
 
 /* Given the code lengths (as stored in the PNG file), generate the
-   tree as defined by Deflate. maxbitlen is the maximum bits that a
-   code in the tree can have. Return value is error.*/
+   decoding tables of the tree as defined by Deflate. */
 static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree,
 					const unsigned *bitlen)
 {
-	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
-	unsigned nextcode[MAX_BIT_LENGTH+1];
-	unsigned bits, n, i;
-	unsigned nodefilled = 0; /* Up to which node it is filled */
-	unsigned treepos = 0; /* Position in the tree (1 of the
-				 numcodes columns) */
-
-	/* initialize local vectors */
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned nextcode[MAX_BIT_LENGTH + 1];
+	unsigned nextsymbol[MAX_BIT_LENGTH + 1];
+	unsigned bits, code, n, len, symbol = 0;
+
 	memset_s(blcount, sizeof(blcount), 0, sizeof(blcount));
-	memset_s(nextcode, sizeof(nextcode), 0, sizeof(nextcode));
-	memset_s(tree1d, sizeof(tree1d), 0, sizeof(tree1d));
+	memset_s(tree->fast, sizeof(tree->fast), 0, sizeof(tree->fast));
 
 	/* Step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
-	}
-
-	/* Step 2: generate the nextcode values */
-	for (bits = 1; bits <= tree->maxbitlen; bits++) {
-		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-	}
-
-	/* Step 3: generate all the codes */
 	for (n = 0; n < tree->numcodes; n++) {
-		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+		if (bitlen[n] > MAX_BIT_LENGTH) {
+			SET_ERROR(upng, EFI_INVALID_PARAMETER);
+			return;
 		}
+		blcount[bitlen[n]]++;
 	}
-
-	/* convert tree1d[] to tree2d[][]. In the 2D array, a value of
-	   32767 means uninited, a value >= numcodes is an address to
-	   another bit, a value < numcodes is a code. The 2 rows are
-	   the 2 possible bit values (0 or 1), there are as many
-	   columns as codes - 1 a good huffmann tree has N * 2 - 1
-	   nodes, of which N - 1 are internal nodes. Here, the
-	   internal nodes are stored (what their 0 and 1 option point
-	   to). There is only memory for such good tree currently, if
-	   there are more nodes (due to too long length codes), error
-	   55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767; /* 32767 here means the
-					    tree2d isn't filled there
-					    yet */
-	}
-
-	for (n = 0; n < tree->numcodes; n++) { /* The codes */
-		for (i = 0; i < bitlen[n]; i++) { /* The bits for this code */
-			unsigned char bit =
-				(unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* Check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
-				SET_ERROR(upng, EFI_INVALID_PARAMETER);
-				return;
-			}
-
-			/* Not yet filled in */
-			if (tree->tree2d[2 * treepos + bit] == 32767) {
-				if (i + 1 == bitlen[n]) { /* Last bit */
-					/* Put the current code in
-					   it */
-					tree->tree2d[2 * treepos + bit] = n;
-					treepos = 0;
-					/* put address of the next
-					   step in here, first that
-					   address has to be found of
-					   course (it's just
-					   nodefilled + 1)... */
-				} else {
-					nodefilled++;
-					/* Addresses encoded with
-					   numcodes added to it */
-					tree->tree2d[2 * treepos + bit] =
-						nodefilled + tree->numcodes;
-					treepos = nodefilled;
-				}
-			} else {
-				treepos = tree->tree2d[2 * treepos + bit] -
-					tree->numcodes;
-			}
+	blcount[0] = 0;
+
+	/* Step 2: generate the first code and symbol index of each
+	   length */
+	for (code = 0, bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+		nextcode[bits] = tree->firstcode[bits] = code;
+		nextsymbol[bits] = tree->firstsymbol[bits] = symbol;
+		code += blcount[bits];
+		/* Check if oversubscribed */
+		if (code > (1U << bits)) {
+			SET_ERROR(upng, EFI_INVALID_PARAMETER);
+			return;
 		}
+		tree->maxcode[bits] = code << (16 - bits);
+		code <<= 1;
+		symbol += blcount[bits];
 	}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/* Remove possible
-						   remaining 32767's */
-		}
+	/* Step 3: assign the codes and fill the fast table.  Deflate
+	   stores the codes most significant bit first, hence the
+	   reversed index. */
+	for (n = 0; n < tree->numcodes; n++) {
+		len = bitlen[n];
+		if (len == 0)
+			continue;
+
+		tree->symbols[nextsymbol[len]++] = n;
+		code = nextcode[len]++;
+		if (len > HUFFMAN_FAST_BITS)
+			continue;
+
+		for (code = reverse_bits(code, len);
+		     code < (1 << HUFFMAN_FAST_BITS); code += 1 << len)
+			tree->fast[code] = (n << 4) | len;
 	}
 }
 
@@ -346,33 +283,69 @@ static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in,
 				      unsigned long *bp, const huffman_tree* codetree,
 				      unsigned long inlength)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
+	UINT32 bits;
+	unsigned len, symbol, code, index;
+
+	/* error: End of input memory reached without endcode */
+	if (((*bp) >> 3) >= inlength) {
+		SET_ERROR(upng, EFI_INVALID_PARAMETER);
+		return 0;
+	}
 
-	for (;;) {
-		/* error: End of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
+	bits = peek_bits(in, *bp, inlength);
+	symbol = codetree->fast[bits & HUFFMAN_FAST_MASK];
+	if (symbol) {
+		len = symbol & 0xF;
+		symbol >>= 4;
+	} else {
+		code = reverse_bits(bits & 0xFFFF, 16);
+		for (len = HUFFMAN_FAST_BITS + 1; len <= MAX_BIT_LENGTH; len++)
+			if (code < codetree->maxcode[len])
+				break;
+		if (len > MAX_BIT_LENGTH) {
 			SET_ERROR(upng, EFI_INVALID_PARAMETER);
 			return 0;
 		}
 
-		bit = read_bit(bp, in);
-
-		if (codetree->tree2d == NULL){
+		index = (code >> (16 - len)) - codetree->firstcode[len] +
+			codetree->firstsymbol[len];
+		if (index >= codetree->numcodes) {
 			SET_ERROR(upng, EFI_INVALID_PARAMETER);
-                        return 0;
-		}
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
+			return 0;
 		}
+		symbol = codetree->symbols[index];
+	}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
-			SET_ERROR(upng, EFI_INVALID_PARAMETER);
-			return 0;
+	if ((*bp) + len > inlength * 8) {
+		SET_ERROR(upng, EFI_INVALID_PARAMETER);
+		return 0;
+	}
+
+	(*bp) += len;
+	return symbol;
+}
+
+/* Copy a match of LENGTH bytes at DISTANCE bytes back.  The source
+   and destination overlap when DISTANCE < LENGTH: 8 bytes blocks are
+   only safe when the source is at least 8 bytes behind. */
+static void copy_match(unsigned char *out, unsigned long distance,
+		       unsigned long length)
+{
+	const unsigned char *src = out - distance;
+
+	if (distance >= sizeof(UINT64))
+		for (; length >= sizeof(UINT64); length -= sizeof(UINT64)) {
+			*(unaligned_u64 *)out = *(const unaligned_u64 *)src;
+			out += sizeof(UINT64);
+			src += sizeof(UINT64);
 		}
+	else if (distance == 1) {
+		memset_s(out, length, *src, length);
+		return;
 	}
+
+	while (length--)
+		*out++ = *src++;
 }
 
 /* Get the tree of a deflated block with dynamic tree, the tree itself
@@ -404,17 +377,17 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree,
 	/* The bit pointer is or will go past the memory */
 	/* Number of literal/length codes + 257. Unlike the spec, the
 	   value 257 is added to it here already */
-	hlit = read_bits(bp, in, 5) + 257;
+	hlit = read_bits(bp, in, inlength, 5) + 257;
 	/* Number of distance codes. Unlike the spec, the value 1 is
 	   added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;
+	hdist = read_bits(bp, in, inlength, 5) + 1;
 	/* Number of code length codes. Unlike the spec, the value 4
 	   is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;
+	hclen = read_bits(bp, in, inlength, 4) + 4;
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			codelengthcode[CLCL[i]] = read_bits(bp, in, inlength, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0; /* if not, it
 							must stay 0 */
@@ -460,7 +433,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree,
 				break;
 			}
 			/* Error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
+			replength += read_bits(bp, in, inlength, 2);
 
 			if ((i - 1) < hlit) {
 				value = bitlen[i - 1];
@@ -493,7 +466,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree,
 			}
 
 			/* Error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
+			replength += read_bits(bp, in, inlength, 3);
 
 			/* Repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
@@ -520,7 +493,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree,
 				break;
 			}
 
-			replength += read_bits(bp, in, 7);
+			replength += read_bits(bp, in, inlength, 7);
 
 			/* Repeat this value in the next lengths */
 			for (n = 0; n < replength; n++) {
@@ -564,36 +537,49 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			    unsigned long *pos, unsigned long inlength,
 			    unsigned btype)
 {
-	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
+	static huffman_tree fixed_codetree, fixed_codetreeD;
+	static BOOLEAN fixed_trees_ready;
+	huffman_tree dynamic_codetree, dynamic_codetreeD;
+	huffman_tree *codetree, *codetreeD;
 	unsigned done = 0;
 
-	huffman_tree codetree = {0};
-	huffman_tree codetreeD = {0};
-
 	if (btype == 1) {
 		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE,
-				  NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE,
-				  NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-	} else if (btype == 2) {
+		if (!fixed_trees_ready) {
+			unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+			unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+			unsigned n;
+
+			for (n = 0; n < NUM_DEFLATE_CODE_SYMBOLS; n++)
+				bitlen[n] = n <= 143 ? 8 : n <= 255 ? 9 : n <= 279 ? 7 : 8;
+			for (n = 0; n < NUM_DISTANCE_SYMBOLS; n++)
+				bitlenD[n] = 5;
+
+			huffman_tree_init(&fixed_codetree, NUM_DEFLATE_CODE_SYMBOLS);
+			huffman_tree_init(&fixed_codetreeD, NUM_DISTANCE_SYMBOLS);
+			huffman_tree_create_lengths(upng, &fixed_codetree, bitlen);
+			huffman_tree_create_lengths(upng, &fixed_codetreeD, bitlenD);
+			if (upng->error != EFI_SUCCESS)
+				return;
+			fixed_trees_ready = TRUE;
+		}
+		codetree = &fixed_codetree;
+		codetreeD = &fixed_codetreeD;
+	} else {
 		/* dynamic trees */
-		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
 		huffman_tree codelengthcodetree;
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS,
-				  DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS,
-				  DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer,
-				  NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD,
+		codetree = &dynamic_codetree;
+		codetreeD = &dynamic_codetreeD;
+		huffman_tree_init(codetree, NUM_DEFLATE_CODE_SYMBOLS);
+		huffman_tree_init(codetreeD, NUM_DISTANCE_SYMBOLS);
+		huffman_tree_init(&codelengthcodetree, NUM_CODE_LENGTH_CODES);
+		get_tree_inflate_dynamic(upng, codetree, codetreeD,
 					 &codelengthcodetree, in, bp, inlength);
 	}
 
 	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+		unsigned code = huffman_decode_symbol(upng, in, bp, codetree, inlength);
 		if (upng->error != EFI_SUCCESS) {
 			return;
 		}
@@ -615,7 +601,7 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			/* Part 1: get length base */
 			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
 			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
+			unsigned long numextrabits;
 
 			/* Part 2: get extra bits and add the value of
 			 * that to length */
@@ -626,10 +612,10 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 				SET_ERROR(upng, EFI_INVALID_PARAMETER);
 				return;
 			}
-			length += read_bits(bp, in, numextrabits);
+			length += read_bits(bp, in, inlength, numextrabits);
 
 			/* Part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			codeD = huffman_decode_symbol(upng, in, bp, codetreeD, inlength);
 			if (upng->error != EFI_SUCCESS) {
 				return;
 			}
@@ -652,26 +638,17 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 				return;
 			}
 
-			distance += read_bits(bp, in, numextrabitsD);
+			distance += read_bits(bp, in, inlength, numextrabitsD);
 
 			/* Part 5: fill in all the out[n] values based
 			 * on the length and dist */
-			start = (*pos);
-			backward = start - distance;
-
-			if ((*pos) + length >= outsize) {
+			if (distance > (*pos) || (*pos) + length >= outsize) {
 				SET_ERROR(upng, EFI_INVALID_PARAMETER);
 				return;
 			}
 
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
-
-				if (backward >= start) {
-					backward = start - distance;
-				}
-			}
+			copy_match(out + (*pos), distance, length);
+			(*pos) += length;
 		}
 	}
 }
@@ -740,6 +717,11 @@ static EFI_STATUS uz_inflate_data(upng_t* upng, unsigned char* out,
 
 	unsigned done = 0;
 
+	/* The bit readers load whole words, bound them to the deflate
+	 * data */
+	in += inpos;
+	insize -= inpos;
+
 	while (done == 0) {
 		unsigned btype;
 
@@ -751,18 +733,18 @@ static EFI_STATUS uz_inflate_data(upng_t* upng, unsigned char* out,
 		}
 
 		/* Read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+		done = read_bits(&bp, in, insize, 1);
+		btype = read_bits(&bp, in, insize, 2);
 
 		/* Process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, EFI_INVALID_PARAMETER);
 			return upng->error;
 		} else if (btype == 0) { /* No compression */
-			inflate_uncompressed(upng, out, outsize, &in[inpos],
+			inflate_uncompressed(upng, out, outsize, in,
 					     &bp, &pos, insize);
 		} else { /* Compression, btype 01 or 10 */
-			inflate_huffman(upng, out, outsize, &in[inpos],
+			inflate_huffman(upng, out, outsize, in,
 					&bp, &pos, insize, btype);
 		}
 